@@ -4,9 +4,14 @@
 #include "Configuration.h"
 #include "IPCClient.h"
 #include "CalibrationCalc.h"
+#include "CalibrationWorker.h"
 #include "VRState.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 
@@ -24,9 +29,92 @@ inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t& lhs, const vr::H
 CalibrationContext CalCtx;
 IPCClient Driver;
 static protocol::DriverPoseShmem shmem;
+static protocol::DeviceTransformShmem transformShmem;
+static protocol::DriverStatsShmem driverStats;
 
 namespace {
-	CalibrationCalc calibration;
+	CalibrationWorker calibration;
+
+	// Minimum time between calibration ticks, in seconds. Samples are collected once per tick.
+	const double TickInterval = 0.05;
+
+	/*
+	 * Lets the main loop sleep until the driver publishes new poses, rather than polling for the next tick.
+	 * Once armed, a helper thread waits until the tick is due, then for the first pose written after that,
+	 * and calls the wake function, which interrupts the main loop's event wait. Each Arm covers one wakeup;
+	 * arming again before it fired replaces the pending one.
+	 */
+	class PoseWakeup
+	{
+	public:
+		~PoseWakeup() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_signal.notify_one();
+			if (m_thread.joinable()) m_thread.join();
+		}
+
+		bool Arm(double delay, void (*wake)()) {
+			if (!shmem.NotificationsAvailable()) return false;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_due = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(std::max<double>(delay, 0.0)));
+				m_wake = wake;
+				m_armed = true;
+				m_generation++;
+			}
+			if (!m_thread.joinable()) m_thread = std::thread(&PoseWakeup::Run, this);
+			m_signal.notify_one();
+			return true;
+		}
+
+	private:
+		// Longest single wait on the shmem, which bounds how long re-arming or shutting down can take to be noticed.
+		static const uint32_t WaitSliceMs = 100;
+
+		std::mutex m_mutex;
+		std::condition_variable m_signal;
+		std::chrono::steady_clock::time_point m_due;
+		void (*m_wake)() = nullptr;
+		bool m_armed = false, m_stop = false;
+		uint64_t m_generation = 0;
+		std::thread m_thread;
+
+		void Run() {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (;;) {
+				m_signal.wait(lock, [this] { return m_stop || m_armed; });
+				if (m_stop) return;
+
+				const uint64_t generation = m_generation;
+				if (m_signal.wait_until(lock, m_due, [&] { return m_stop || m_generation != generation; })) continue;
+
+				lock.unlock();
+				const uint64_t seen = shmem.PoseEntry();
+				uint64_t entry = seen;
+				for (;;) {
+					entry = shmem.WaitForNewPoses(seen, WaitSliceMs);
+
+					lock.lock();
+					if (m_stop || m_generation != generation || entry != seen) break;
+					lock.unlock();
+				}
+				if (m_stop || m_generation != generation) continue;
+
+				m_armed = false;
+				auto wake = m_wake;
+				lock.unlock();
+				wake();
+				lock.lock();
+			}
+		}
+	};
+
+	PoseWakeup poseWakeup;
 
 	inline vr::HmdVector3d_t quaternionRotateVector(const vr::HmdQuaternion_t& quat, const double(&vector)[3]) {
 		vr::HmdQuaternion_t vectorQuat = { 0.0, vector[0], vector[1] , vector[2] };
@@ -126,52 +214,72 @@ namespace {
 		return ds;
 	}
 
-	Pose ConvertPose(const vr::DriverPose_t &driverPose) {
-		Eigen::Quaterniond driverToWorldQ(
-			driverPose.qWorldFromDriverRotation.w,
-			driverPose.qWorldFromDriverRotation.x,
-			driverPose.qWorldFromDriverRotation.y,
-			driverPose.qWorldFromDriverRotation.z
-		);
-		Eigen::Vector3d driverToWorldV(
-			driverPose.vecWorldFromDriverTranslation[0],
-			driverPose.vecWorldFromDriverTranslation[1],
-			driverPose.vecWorldFromDriverTranslation[2]
-		);
+	// The driver publishes poses already composed into world space.
+	Pose ConvertPose(const protocol::CompactPose &pose) {
+		Eigen::Quaterniond rot(pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3]);
+		rot.normalize(); // stored in single precision
 
-		Eigen::Quaterniond driverRot = driverToWorldQ * Eigen::Quaterniond(
-			driverPose.qRotation.w,
-			driverPose.qRotation.x,
-			driverPose.qRotation.y,
-			driverPose.qRotation.z
-		);
-		
-		Eigen::Vector3d driverPos = driverToWorldV + driverToWorldQ * Eigen::Vector3d(
-			driverPose.vecPosition[0],
-			driverPose.vecPosition[1],
-			driverPose.vecPosition[2]
-		);
+		return Pose(rot, Eigen::Vector3d(pose.position[0], pose.position[1], pose.position[2]));
+	}
 
-		Eigen::AffineCompact3d xform = Eigen::Translation3d(driverPos) * driverRot;
+	/*
+	 * The continuous calibration tracker offset is given in the reference driver's space, but compact poses come
+	 * already composed into world space. While an offset is set, the full poses are read as well, for the
+	 * reference's world-from-driver rotation.
+	 */
+	struct ReferenceWorldFromDriver
+	{
+		int id = -1; // device the rotation was taken from, or -1 if there is none yet
+		Eigen::Quaterniond rotation = Eigen::Quaterniond::Identity();
+	} referenceWorldFromDriver;
 
-		return Pose(xform);
+	bool UsesTrackerOffset(const CalibrationContext& ctx)
+	{
+		return (ctx.state == CalibrationState::Continuous || ctx.state == CalibrationState::ContinuousStandby)
+			&& !ctx.continuousCalibrationOffset.isZero();
 	}
 
-	bool CollectSample(const CalibrationContext& ctx)
+	/*
+	 * Calibration only looks at the HMD and the reference and target devices, so fetch just their newest poses
+	 * from the shmem rather than replaying every pose the driver published since the last tick.
+	 */
+	void RefreshDevicePoses(CalibrationContext& ctx)
 	{
-		vr::DriverPose_t reference, target;
-		reference.poseIsValid = false;
-		target.poseIsValid = false;
+		const int devices[] = { (int)vr::k_unTrackedDeviceIndex_Hmd, ctx.referenceID, ctx.targetID };
+		for (int id : devices) {
+			protocol::CompactPose pose;
+			if (shmem.GetLatestPose(id, pose)) {
+				ctx.devicePoses[id] = pose;
+			}
+		}
 
-		reference = ctx.devicePoses[ctx.referenceID];
-		target = ctx.devicePoses[ctx.targetID];
+		const bool usesTrackerOffset = UsesTrackerOffset(ctx);
+		shmem.SetFullPosesEnabled(usesTrackerOffset);
+		if (!usesTrackerOffset || referenceWorldFromDriver.id != ctx.referenceID) {
+			referenceWorldFromDriver.id = -1;
+		}
+		if (usesTrackerOffset) {
+			shmem.ReadNewFullPoses([&](const protocol::DriverPoseShmem::AugmentedPose& record) {
+				if (record.deviceId == ctx.referenceID) {
+					const vr::HmdQuaternion_t& q = record.pose.qWorldFromDriverRotation;
+					referenceWorldFromDriver.id = record.deviceId;
+					referenceWorldFromDriver.rotation = Eigen::Quaterniond(q.w, q.x, q.y, q.z);
+				}
+			});
+		}
+	}
+
+	bool CollectSample(const CalibrationContext& ctx)
+	{
+		protocol::CompactPose reference = ctx.devicePoses[ctx.referenceID];
+		protocol::CompactPose target = ctx.devicePoses[ctx.targetID];
 
 		bool ok = true;
-		if (!reference.poseIsValid)
+		if (!reference.poseIsValid())
 		{
 			CalCtx.Log("Reference device is not tracking\n"); ok = false;
 		}
-		if (!target.poseIsValid)
+		if (!target.poseIsValid())
 		{
 			CalCtx.Log("Target device is not tracking\n"); ok = false;
 		}
@@ -184,17 +292,32 @@ namespace {
 			return false;
 		}
 
-		// Apply tracker offsets
-		if (CalCtx.state == CalibrationState::Continuous || CalCtx.state == CalibrationState::ContinuousStandby) {
-			reference.vecPosition[0] += ctx.continuousCalibrationOffset.x();
-			reference.vecPosition[1] += ctx.continuousCalibrationOffset.y();
-			reference.vecPosition[2] += ctx.continuousCalibrationOffset.z();
+		// Apply tracker offsets, which are in the reference driver's space
+		if (UsesTrackerOffset(ctx)) {
+			if (referenceWorldFromDriver.id != ctx.referenceID) {
+				// No full pose of the reference has come in yet; skip the sample rather than misplace it.
+				return false;
+			}
+
+			const Eigen::Vector3d offset = referenceWorldFromDriver.rotation * ctx.continuousCalibrationOffset;
+			reference.position[0] += offset.x();
+			reference.position[1] += offset.y();
+			reference.position[2] += offset.z();
 		}
 
+		CalibrationWorker::Settings settings;
+		settings.windowSize = ctx.SampleCount();
+		settings.pairSelection = (CalibrationCalc::PairSelection)ctx.pairSelection;
+		settings.pairBudget = (size_t)std::max<int>(ctx.pairBudget, 1);
+		settings.continuous = ctx.state == CalibrationState::Continuous;
+		settings.enableStaticRecalibration = ctx.enableStaticRecalibration;
+		settings.lockRelativePosition = ctx.lockRelativePosition;
+		settings.threshold = ctx.continuousCalibrationThreshold;
+
 		calibration.PushSample(Sample(
 			ConvertPose(reference),
 			ConvertPose(target)
-		));
+		), settings);
 
 		return true;
 	}
@@ -230,9 +353,21 @@ void InitCalibrator()
 {
 	Driver.Connect();
 	shmem.Open(OPENVR_SPACECALIBRATOR_SHMEM_NAME);
+	transformShmem.Open(OPENVR_SPACECALIBRATOR_CONTROL_SHMEM_NAME);
+	driverStats.Open(OPENVR_SPACECALIBRATOR_STATS_SHMEM_NAME);
+}
+
+const protocol::DriverStatsShmem& DriverStats()
+{
+	return driverStats;
 }
 
-void ResetAndDisableOffsets(uint32_t id)
+bool ArmPoseWakeup(double time, void (*wake)())
+{
+	return poseWakeup.Arm(CalCtx.timeLastTick + TickInterval - time, wake);
+}
+
+void ResetAndDisableOffsets(protocol::SetDeviceTransforms& transforms, uint32_t id)
 {
 	vr::HmdVector3d_t zeroV;
 	zeroV.v[0] = zeroV.v[1] = zeroV.v[2] = 0;
@@ -240,9 +375,7 @@ void ResetAndDisableOffsets(uint32_t id)
 	vr::HmdQuaternion_t zeroQ;
 	zeroQ.x = 0; zeroQ.y = 0; zeroQ.z = 0; zeroQ.w = 1;
 
-	protocol::Request req(protocol::RequestSetDeviceTransform);
-	req.setDeviceTransform = { id, false, zeroV, zeroQ, 1.0 };
-	Driver.SendBlocking(req);
+	transforms.Add(protocol::SetDeviceTransform(id, false, zeroV, zeroQ, 1.0));
 }
 
 static_assert(vr::k_unTrackedDeviceIndex_Hmd == 0, "HMD index expected to be 0");
@@ -253,9 +386,10 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 	char* buffer = buffer_array.get();
 	ctx.enabled = ctx.validProfile;
 
-	protocol::Request setParamsReq(protocol::RequestSetAlignmentSpeedParams);
-	setParamsReq.setAlignmentSpeedParams = ctx.alignmentSpeedParams;
-	Driver.SendBlocking(setParamsReq);
+	// Every device's transform goes to the driver in one table, published once the scan is done.
+	protocol::SetDeviceTransforms transforms;
+	transforms.alignmentSpeedParams = ctx.alignmentSpeedParams;
+	transforms.count = 0;
 
 	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
 	{
@@ -268,13 +402,13 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 			vr::ETrackedPropertyError err = vr::TrackedProp_Success;
 			auto universeId = vr::VRSystem()->GetUint64TrackedDeviceProperty(id, vr::Prop_CurrentUniverseId_Uint64, &err);
 			printf("uid %d err %d\n", universeId, err);
-			ResetAndDisableOffsets(id);
+			ResetAndDisableOffsets(transforms, id);
 			continue;
 		}*/
 
 		if (!ctx.enabled)
 		{
-			ResetAndDisableOffsets(id);
+			ResetAndDisableOffsets(transforms, id);
 			continue;
 		}
 
@@ -283,7 +417,7 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 
 		if (err != vr::TrackedProp_Success)
 		{
-			ResetAndDisableOffsets(id);
+			ResetAndDisableOffsets(transforms, id);
 			continue;
 		}
 
@@ -316,7 +450,7 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 				ctx.enabled = false;
 			}
 
-			ResetAndDisableOffsets(id);
+			ResetAndDisableOffsets(transforms, id);
 			continue;
 		}
 
@@ -339,24 +473,26 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 
 		if (trackingSystem != ctx.targetTrackingSystem)
 		{
-			ResetAndDisableOffsets(id);
+			ResetAndDisableOffsets(transforms, id);
 			continue;
 		}
 
-		protocol::Request req(protocol::RequestSetDeviceTransform);
-		req.setDeviceTransform = {
+		protocol::SetDeviceTransform transform(
 			id,
 			true,
 			VRTranslationVec(ctx.calibratedTranslation),
 			VRRotationQuat(ctx.calibratedRotation),
 			ctx.calibratedScale
-		};
-		req.setDeviceTransform.lerp = CalCtx.state == CalibrationState::Continuous;
-		req.setDeviceTransform.quash = CalCtx.state == CalibrationState::Continuous && id == CalCtx.targetID && CalCtx.quashTargetInContinuous;
+		);
+		transform.lerp = CalCtx.state == CalibrationState::Continuous;
+		transform.quash = CalCtx.state == CalibrationState::Continuous && id == CalCtx.targetID && CalCtx.quashTargetInContinuous;
 
-		Driver.SendBlocking(req);
+		transforms.Add(transform);
 	}
 
+	// The driver picks the table up with its next pose update.
+	transformShmem.Publish(transforms);
+
 	if (ctx.enabled && ctx.chaperone.valid && ctx.chaperone.autoApply)
 	{
 		uint32_t quadCount = 0;
@@ -384,8 +520,7 @@ void StartContinuousCalibration() {
 	AssignTargets();
 	StartCalibration();
 	CalCtx.state = CalibrationState::Continuous;
-	calibration.setRelativeTransformation(CalCtx.refToTargetPose, CalCtx.relativePosCalibrated);
-	calibration.lockRelativePosition = CalCtx.lockRelativePosition;
+	calibration.SetRelativeTransformation(CalCtx.refToTargetPose, CalCtx.relativePosCalibrated);
 	if (CalCtx.lockRelativePosition) {
 		CalCtx.Log("Relative position locked");
 	}
@@ -398,17 +533,55 @@ void StartContinuousCalibration() {
 void EndContinuousCalibration() {
 	CalCtx.state = CalibrationState::None;
 	CalCtx.relativePosCalibrated = false;
+	calibration.Clear();
 	SaveProfile(CalCtx);
 	Metrics::WriteLogAnnotation("EndContinuousCalibration");
 }
 
+static void ApplyCalibrationResult(CalibrationContext& ctx, CalibrationWorker::Result& result)
+{
+	if (result.continuous) {
+		ctx.messages.clear();
+	}
+
+	if (!result.log.empty()) {
+		ctx.Log(result.log);
+	}
+
+	if (result.valid) {
+		ctx.calibratedRotation = result.eulerRotation;
+		ctx.calibratedTranslation = result.transformation.translation() * 100.0; // convert to cm units for profile storage
+		ctx.refToTargetPose = result.relativeTransformation;
+		ctx.relativePosCalibrated = result.relativeCalibrated;
+
+		ctx.validProfile = true;
+		SaveProfile(ctx);
+
+		ScanAndApplyProfile(ctx);
+
+		ctx.Log("Finished calibration, profile saved\n");
+	} else {
+		ctx.Log("Calibration failed.\n");
+	}
+
+	result.metrics.Flush();
+	Metrics::WriteLogEntry();
+
+	if (ctx.state != CalibrationState::Continuous) {
+		ctx.state = CalibrationState::None;
+	}
+}
+
 void CalibrationTick(double time)
 {
 	if (!vr::VRSystem())
 		return;
 
+	// Requests are sent asynchronously; fail here, as a blocking send would have, if one of them could not be.
+	Driver.RethrowError();
+
 	auto &ctx = CalCtx;
-	if ((time - ctx.timeLastTick) < 0.05)
+	if ((time - ctx.timeLastTick) < TickInterval)
 		return;
 
 	if (ctx.state == CalibrationState::Continuous || ctx.state == CalibrationState::ContinuousStandby) {
@@ -416,14 +589,15 @@ void CalibrationTick(double time)
 	}
 
 	ctx.timeLastTick = time;
-	shmem.ReadNewPoses([&](const protocol::DriverPoseShmem::AugmentedPose& augmented_pose) {
-		if (augmented_pose.deviceId >= 0 && augmented_pose.deviceId <= vr::k_unMaxTrackedDeviceCount) {
-			ctx.devicePoses[augmented_pose.deviceId] = augmented_pose.pose;
-		}
-	});
+	RefreshDevicePoses(ctx);
+
+	// Solves run on the calibration worker; pick up whatever it finished since the last tick.
+	if (auto result = calibration.PollResult()) {
+		ApplyCalibrationResult(ctx, *result);
+	}
 
 	// check for non-updating headset tracking space (caused by quest out of bounds or taken off head for example) and abort everything for this tick
-	auto p = ctx.devicePoses[vr::k_unTrackedDeviceIndex_Hmd].vecPosition;
+	auto p = ctx.devicePoses[vr::k_unTrackedDeviceIndex_Hmd].position;
 	if ((p[0] == 0.0 && p[1] == 0.0 && p[2] == 0.0) || (ctx.xprev == p[0] && ctx.yprev == p[1] && ctx.zprev == p[2])) {
 		// std::cerr << "HMD tracking didn't update, skipping update" << std::endl;
 		return;
@@ -433,7 +607,7 @@ void CalibrationTick(double time)
 	ctx.zprev = p[2];
 
 	if (ctx.state == CalibrationState::None || ctx.state == CalibrationState::ContinuousStandby
-		|| (ctx.state == CalibrationState::Continuous && !calibration.isValid()))
+		|| (ctx.state == CalibrationState::Continuous && !calibration.IsValid()))
 	{
 		if ((time - ctx.timeLastScan) >= 1.0)
 		{
@@ -445,6 +619,7 @@ void CalibrationTick(double time)
 	if (ctx.state == CalibrationState::ContinuousStandby) {
 		if (AssignTargets()) {
 			StartContinuousCalibration();
+			RefreshDevicePoses(ctx);
 		}
 		else {
 			ctx.wantedUpdateInterval = 0.5;
@@ -549,72 +724,14 @@ void CalibrationTick(double time)
 		}
 	}
 
+	// The worker solves once its window (sized by the speed setting) is full.
 	if (!CollectSample(ctx))
 	{
 		return;
 	}
 
-	CalCtx.Progress(calibration.SampleCount(), (int)CalCtx.SampleCount());
-
-	while (calibration.SampleCount() > CalCtx.SampleCount()) calibration.ShiftSample();
-
-	if (calibration.SampleCount() >= CalCtx.SampleCount())
-	{
-		LARGE_INTEGER start_time;
-		QueryPerformanceCounter(&start_time);
-		
-		bool ok, lerp = false;
-
-		if (CalCtx.state == CalibrationState::Continuous) {
-			CalCtx.messages.clear();
-			calibration.enableStaticRecalibration = CalCtx.enableStaticRecalibration;
-			calibration.lockRelativePosition = CalCtx.lockRelativePosition;
-			ok = calibration.ComputeIncremental(lerp, CalCtx.continuousCalibrationThreshold);
-		}
-		else {
-			calibration.enableStaticRecalibration = false;
-			ok = calibration.ComputeOneshot();
-		}
-
-		if (calibration.isValid()) {
-			ctx.calibratedRotation = calibration.EulerRotation();
-			ctx.calibratedTranslation = calibration.Transformation().translation() * 100.0; // convert to cm units for profile storage
-			ctx.refToTargetPose = calibration.RelativeTransformation();
-			ctx.relativePosCalibrated = calibration.isRelativeTransformationCalibrated();
-
-			auto vrTrans = VRTranslationVec(ctx.calibratedTranslation);
-			auto vrRot = VRRotationQuat(Eigen::Quaterniond(calibration.Transformation().rotation()));
-
-			ctx.validProfile = true;
-			SaveProfile(ctx);
-
-			ScanAndApplyProfile(ctx);
-
-			CalCtx.Log("Finished calibration, profile saved\n");
-		} else {
-			CalCtx.Log("Calibration failed.\n");
-		}
-
-		LARGE_INTEGER end_time;
-		QueryPerformanceCounter(&end_time);
-		LARGE_INTEGER freq;
-		QueryPerformanceFrequency(&freq);
-		double duration = (end_time.QuadPart - start_time.QuadPart) / (double)freq.QuadPart;
-		Metrics::computationTime.Push(duration * 1000.0);
-
-		Metrics::WriteLogEntry();
-		
-		if (CalCtx.state != CalibrationState::Continuous) {
-			ctx.state = CalibrationState::None;
-			calibration.Clear();
-		}
-		else {
-			size_t drop_samples = CalCtx.SampleCount() / 10;
-			for (int i = 0; i < drop_samples; i++) {
-				calibration.ShiftSample();
-			}
-		}
-	}
+	const double coverage = calibration.AxisVariance() / CalibrationCalc::AxisVarianceThreshold;
+	CalCtx.Progress((int)calibration.SampleCount(), (int)CalCtx.SampleCount(), (float)std::min<double>(coverage, 1.0));
 }
 
 void LoadChaperoneBounds()
@@ -642,5 +759,5 @@ void ApplyChaperoneBounds()
 
 void DebugApplyRandomOffset() {
 	protocol::Request req(protocol::RequestDebugOffset);
-	Driver.SendBlocking(req);
+	Driver.SendAsync(req);
 }
\ No newline at end of file
@@ -70,7 +70,17 @@ struct CalibrationContext
 	};
 	Speed calibrationSpeed = FAST;
 
-	vr::DriverPose_t devicePoses[vr::k_unMaxTrackedDeviceCount];
+	enum PairSelection
+	{
+		ALL_PAIRS = 0,
+		RANDOM_PAIRS = 1,
+		STRATIFIED_PAIRS = 2
+	};
+	static const int DefaultPairBudget = 64, MinPairBudget = 16, MaxPairBudget = 512;
+	PairSelection pairSelection = ALL_PAIRS;
+	int pairBudget = DefaultPairBudget;
+
+	protocol::CompactPose devicePoses[vr::k_unMaxTrackedDeviceCount];
 
 	CalibrationContext() {
 		calibratedScale = 1.0;
@@ -129,7 +139,7 @@ struct CalibrationContext
 		relativePosCalibrated = true;
 	}
 
-	size_t SampleCount()
+	size_t SampleCount() const
 	{
 		switch (calibrationSpeed)
 		{
@@ -155,6 +165,8 @@ struct CalibrationContext
 
 		std::string str;
 		int progress, target;
+		// Fraction of the rotation variety the solver needs, or negative if not known.
+		float rotationCoverage = -1.0f;
 	};
 
 	std::deque<Message> messages;
@@ -177,23 +189,24 @@ struct CalibrationContext
 		while (messages.size() > 15) messages.pop_front();
 	}
 
-	void Progress(int current, int target)
+	void Progress(int current, int target, float rotationCoverage = -1.0f)
 	{
 		if (messages.empty() || messages.back().type == Message::String)
 			messages.push_back(Message(Message::Progress));
 
 		messages.back().progress = current;
 		messages.back().target = target;
+		messages.back().rotationCoverage = rotationCoverage;
 	}
 
 	bool TargetPoseIsValid() const {
 		return targetID >= 0 && targetID <= vr::k_unMaxTrackedDeviceCount
-			&& devicePoses[targetID].poseIsValid;
+			&& devicePoses[targetID].poseIsValid();
 	}
 
 	bool ReferencePoseIsValid() const {
 		return referenceID >= 0 && referenceID <= vr::k_unMaxTrackedDeviceCount
-			&& devicePoses[referenceID].poseIsValid;
+			&& devicePoses[referenceID].poseIsValid();
 	}
 };
 
@@ -201,6 +214,16 @@ extern CalibrationContext CalCtx;
 
 void InitCalibrator();
 void CalibrationTick(double time);
+
+/* The driver's pose hook statistics; open once InitCalibrator has run. */
+const protocol::DriverStatsShmem& DriverStats();
+
+/*
+ * Arranges for `wake` to be called, from another thread, on the first pose the driver publishes once the next
+ * calibration tick is due. Returns false if the driver cannot notify us of new poses, in which case the caller
+ * has to keep polling CalibrationTick.
+ */
+bool ArmPoseWakeup(double time, void (*wake)());
 void StartCalibration();
 void StartContinuousCalibration();
 void EndContinuousCalibration();
@@ -1,7 +1,6 @@
 #include "CalibrationCalc.h"
-#include "Calibration.h"
 #include "CalibrationMetrics.h"
-#include "..\Protocol.h"
+#include "../Protocol.h"
 
 inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t& lhs, const vr::HmdQuaternion_t& rhs) {
 	return {
@@ -105,67 +104,292 @@ namespace {
 		ds.target.normalize();
 		return ds;
 	}
+
+	const int DeltaBatchSize = 32;
+	typedef Eigen::Array<double, Eigen::Dynamic, 1, 0, DeltaBatchSize, 1> DeltaBatchArray;
+
+	/*
+	 * Axis term and cosine of the angle of a * b^-1, for each quaternion b = (w, x, y, z) of a block of n samples.
+	 * For a unit quaternion d, the matrix term R - R^T used by AxisFromRotationMatrix3 is 4 * d.w * d.vec,
+	 * and (trace(R) - 1) / 2 = 2 * d.w^2 - 1.
+	 */
+	void RelativeRotationAxes(
+		const Eigen::Quaterniond& a,
+		const double* w, const double* x, const double* y, const double* z, Eigen::Index n,
+		DeltaBatchArray& axisX, DeltaBatchArray& axisY, DeltaBatchArray& axisZ, DeltaBatchArray& cosAngle
+	) {
+		typedef Eigen::Map<const DeltaBatchArray> Column;
+		const Column bw(w, n), bx(x, n), by(y, n), bz(z, n);
+
+		const DeltaBatchArray dw = a.w() * bw + a.x() * bx + a.y() * by + a.z() * bz;
+		const DeltaBatchArray dx = a.x() * bw - a.w() * bx - (a.y() * bz - a.z() * by);
+		const DeltaBatchArray dy = a.y() * bw - a.w() * by - (a.z() * bx - a.x() * bz);
+		const DeltaBatchArray dz = a.z() * bw - a.w() * bz - (a.x() * by - a.y() * bx);
+
+		axisX = 4.0 * dw * dx;
+		axisY = 4.0 * dw * dy;
+		axisZ = 4.0 * dw * dz;
+		cosAngle = 2.0 * dw.square() - 1.0;
+	}
+
+	/*
+	 * Batch form of DeltaRotationSamples, pairing a new sample with `count` samples of the window: the samples
+	 * [0, count) if `indices` is null, otherwise the listed ones. The angle test acos(c) > 0.4 is done as
+	 * c < cos(0.4). Valid pairs are appended to `out`.
+	 */
+	void DeltaRotationBatch(
+		const SampleBuffer& samples, const size_t* indices, size_t count,
+		const Eigen::Quaterniond& refRot, const Eigen::Quaterniond& targetRot,
+		DeltaAxisBuffer& out
+	) {
+		typedef SampleBuffer S;
+		const double maxCosAngle = cos(0.4);
+
+		for (size_t block = 0; block < count; block += DeltaBatchSize) {
+			const Eigen::Index n = (Eigen::Index)std::min<size_t>(DeltaBatchSize, count - block);
+
+			// Quaternion columns of the block (ref w, x, y, z, then target), gathered when pairing with a subset
+			DeltaBatchArray gathered[8];
+			const double* columns[8];
+			for (int c = 0; c < 8; c++) {
+				const double* column = samples.Data((S::Column)((c < 4 ? S::RefRotW : S::TargetRotW) + c % 4));
+				if (!indices) {
+					columns[c] = column + block;
+					continue;
+				}
+
+				gathered[c].resize(n);
+				for (Eigen::Index k = 0; k < n; k++) {
+					gathered[c](k) = column[indices[block + k]];
+				}
+				columns[c] = gathered[c].data();
+			}
+
+			DeltaBatchArray refX, refY, refZ, refCos, targetX, targetY, targetZ, targetCos;
+			RelativeRotationAxes(refRot, columns[0], columns[1], columns[2], columns[3], n, refX, refY, refZ, refCos);
+			RelativeRotationAxes(targetRot, columns[4], columns[5], columns[6], columns[7], n, targetX, targetY, targetZ, targetCos);
+
+			const DeltaBatchArray refNorm = (refX.square() + refY.square() + refZ.square()).sqrt();
+			const DeltaBatchArray targetNorm = (targetX.square() + targetY.square() + targetZ.square()).sqrt();
+
+			const Eigen::Array<bool, Eigen::Dynamic, 1, 0, DeltaBatchSize, 1> valid =
+				refCos < maxCosAngle && targetCos < maxCosAngle && refNorm > 0.01 && targetNorm > 0.01;
+
+			for (Eigen::Index k = 0; k < n; k++) {
+				if (!valid(k)) continue;
+
+				out.Push(indices ? indices[block + k] : block + k,
+					Eigen::Vector3d(refX(k), refY(k), refZ(k)) / refNorm(k),
+					Eigen::Vector3d(targetX(k), targetY(k), targetZ(k)) / targetNorm(k));
+			}
+		}
+	}
+
+	/*
+	 * Appends `count` distinct indices spread over [0, n), one drawn at random from each of `count` equal strata.
+	 * Requires count <= n.
+	 */
+	void StratifiedRandomIndices(size_t n, size_t count, std::mt19937& rng, std::vector<size_t>& out) {
+		std::uniform_real_distribution<double> jitter(0.0, 1.0);
+		const double width = (double)n / (double)count;
+
+		size_t next = 0;
+		for (size_t m = 0; m < count; m++) {
+			const size_t index = std::max<size_t>(next, (size_t)((m + jitter(rng)) * width));
+			out.push_back(std::min<size_t>(index, n - 1));
+			next = index + 1;
+		}
+	}
+
+	/* Target rotation of a sample as the (w, x, y, z) vector analysed by ComputeAxisVariance. */
+	Eigen::Vector4d TargetRotationVector(const SampleBuffer& samples, size_t index) {
+		const Eigen::Quaterniond q = samples.TargetRotation(index);
+		return Eigen::Vector4d(q.w(), q.x(), q.y(), q.z());
+	}
 }
 
 const double CalibrationCalc::AxisVarianceThreshold = 0.001;
 void CalibrationCalc::PushSample(const Sample& sample) {
-	m_samples.push_back(sample);
+	if (m_samples.Full()) ShiftSample();
+
+	m_samples.Push(
+		Eigen::Quaterniond(sample.ref.rot), sample.ref.trans,
+		Eigen::Quaterniond(sample.target.rot), sample.target.trans,
+		sample.valid
+	);
+
+	// The caches are fed the sample as stored, so that ShiftSample later removes exactly what was added here.
+	const size_t newest = m_samples.Size() - 1;
+	const Sample stored = SampleAt(newest);
+
+	const double pairingStart = Metrics::timestamp();
+
+	// Only the pairs touching the new sample need computing; each is recorded against the older sample,
+	// so that it leaves the cache together with that sample in ShiftSample.
+	if (rotationPairKernel == RotationPairKernel::Batch) {
+		const size_t* indices = nullptr;
+		size_t count = newest;
+		if (pairSelection != PairSelection::All) {
+			SelectPairs(newest, m_pairIndices);
+			indices = m_pairIndices.data();
+			count = m_pairIndices.size();
+		}
+
+		m_deltaAxes.count = 0;
+		DeltaRotationBatch(m_samples, indices, count, m_samples.RefRotation(newest), m_samples.TargetRotation(newest), m_deltaAxes);
+
+		for (size_t k = 0; k < m_deltaAxes.count; k++) {
+			m_rotationPairs[m_samples.Slot(m_deltaAxes.index[k])].Add(m_deltaAxes.ref.col(k), m_deltaAxes.target.col(k));
+		}
+	}
+	else {
+		SelectPairs(newest, m_pairIndices);
+		for (size_t i : m_pairIndices) {
+			auto delta = DeltaRotationSamples(stored, SampleAt(i));
+			if (delta.valid)
+				m_rotationPairs[m_samples.Slot(i)].Add(delta.ref, delta.target);
+		}
+	}
+
+	m_pairingTime += Metrics::timestamp() - pairingStart;
+
+	m_rotationPairs[m_samples.Slot(newest)] = RotationPairStats();
+	m_translationAccum.Push(stored);
+	if (stored.valid) {
+		m_relPoseAccum.Push(CalibrationByRelPose(newest));
+		m_rotationCovariance.Push(TargetRotationVector(m_samples, newest));
+	}
+}
+
+void CalibrationCalc::ShiftSample() {
+	if (m_samples.Empty()) return;
+
+	m_translationAccum.Pop(SampleAt(0));
+	if (m_samples.IsValid(0)) {
+		m_relPoseAccum.Pop(CalibrationByRelPose(0));
+		m_rotationCovariance.Pop(TargetRotationVector(m_samples, 0));
+	}
+	m_samples.PopFront();
+}
+
+void CalibrationCalc::SetWindowSize(size_t size) {
+	size = std::max<size_t>(size, 1);
+	if (size == m_samples.Capacity()) return;
+
+	// Re-pushing the newest samples rebuilds the pair and translation caches for the new slot layout.
+	std::vector<Sample> kept;
+	const size_t first = m_samples.Size() > size ? m_samples.Size() - size : 0;
+	for (size_t i = first; i < m_samples.Size(); i++) {
+		kept.push_back(SampleAt(i));
+	}
+
+	m_samples.Reset(size);
+	m_rotationPairs.assign(size, RotationPairStats());
+	m_deltaAxes.Reserve(size);
+	m_pairIndices.reserve(size);
+	m_translationAccum.Clear();
+	m_relPoseAccum.Clear();
+	m_rotationCovariance.Clear();
+
+	for (const auto& sample : kept) {
+		PushSample(sample);
+	}
+}
+
+void CalibrationCalc::SelectPairs(size_t sample, std::vector<size_t>& out) const {
+	out.clear();
+
+	const size_t budget = std::max<size_t>(pairBudget, 1);
+	if (pairSelection == PairSelection::All || sample <= budget) {
+		for (size_t i = 0; i < sample; i++) out.push_back(i);
+		return;
+	}
+
+	if (pairSelection == PairSelection::RandomBudget) {
+		StratifiedRandomIndices(sample, budget, m_pairRng, out);
+		return;
+	}
+
+	// Bin a larger candidate set by the reference device's relative rotation, cos(angle) = 2 * dot(q_sample, q_i)^2 - 1,
+	// over the range that passes the pair test, then take candidates from the bins in turn.
+	const int Bins = 8;
+	const size_t Oversampling = 4;
+	const double maxCosAngle = cos(0.4);
+
+	std::vector<size_t> candidates;
+	StratifiedRandomIndices(sample, std::min<size_t>(sample, budget * Oversampling), m_pairRng, candidates);
+
+	const Eigen::Quaterniond rot = m_samples.RefRotation(sample);
+	std::vector<size_t> binned[Bins];
+	for (size_t i : candidates) {
+		const double dot = rot.dot(m_samples.RefRotation(i));
+		const double cosAngle = 2.0 * dot * dot - 1.0;
+		if (cosAngle >= maxCosAngle) continue;
+
+		const int bin = (int)((cosAngle + 1.0) / (maxCosAngle + 1.0) * Bins);
+		binned[std::min<int>(std::max<int>(bin, 0), Bins - 1)].push_back(i);
+	}
+
+	for (size_t round = 0; out.size() < budget; round++) {
+		const size_t before = out.size();
+		for (int b = 0; b < Bins && out.size() < budget; b++) {
+			if (round < binned[b].size()) out.push_back(binned[b][round]);
+		}
+		if (out.size() == before) break;
+	}
+
+	std::sort(out.begin(), out.end());
+}
+
+RotationPairStats CalibrationCalc::SumRotationPairs() const {
+	// Summing the per-sample records is drift-free, unlike subtracting evicted pairs from a running total.
+	RotationPairStats pairs;
+	for (size_t i = 0; i < m_samples.Size(); i++) {
+		pairs += m_rotationPairs[m_samples.Slot(i)];
+	}
+	return pairs;
+}
+
+Sample CalibrationCalc::SampleAt(size_t index) const {
+	Sample sample;
+	sample.ref.rot = m_samples.RefRotation(index).toRotationMatrix();
+	sample.ref.trans = m_samples.RefPosition(index);
+	sample.target.rot = m_samples.TargetRotation(index).toRotationMatrix();
+	sample.target.trans = m_samples.TargetPosition(index);
+	sample.valid = m_samples.IsValid(index);
+	return sample;
 }
 
 void CalibrationCalc::Clear() {
 	m_estimatedTransformation.setIdentity();
 	m_isValid = false;
-	m_samples.clear();
+	m_samples.Clear();
+	m_translationAccum.Clear();
+	m_relPoseAccum.Clear();
+	m_rotationCovariance.Clear();
 	m_axisVariance = 0.0;
 	m_refToTargetPose = Eigen::AffineCompact3d::Identity();
 	m_relativePosCalibrated = false;
 }
 
 Eigen::Vector3d CalibrationCalc::CalibrateRotation() const {
-	std::vector<DSample> deltas;
+	const RotationPairStats pairs = SumRotationPairs();
 
-	for (size_t i = 0; i < m_samples.size(); i++)
-	{
-		for (size_t j = 0; j < i; j++)
-		{
-			auto delta = DeltaRotationSamples(m_samples[i], m_samples[j]);
-			if (delta.valid)
-				deltas.push_back(delta);
-		}
-	}
 	//char buf[256];
-	//snprintf(buf, sizeof buf, "Got %zd samples with %zd delta samples\n", m_samples.size(), deltas.size());
+	//snprintf(buf, sizeof buf, "Got %zd samples with %ld delta samples\n", m_samples.size(), pairs.count);
 	//CalCtx.Log(buf);
 
 	// Kabsch algorithm
 
-    // Initialize 2D points and centroids
-    Eigen::MatrixXd refPoints(deltas.size(), 2), targetPoints(deltas.size(), 2);
-    Eigen::Vector2d refCentroid(0, 0), targetCentroid(0, 0);
-
-    // Fill matrices and calculate centroids
-    for (size_t i = 0; i < deltas.size(); i++) {
-        refPoints.row(i) << deltas[i].ref[0], deltas[i].ref[2];  // Take only the x and z components
-        refCentroid += refPoints.row(i);
+	// Centroids of the 2D (x and z) rotation axes
+	Eigen::Vector2d refCentroid = pairs.refSum / (double)pairs.count;
+	Eigen::Vector2d targetCentroid = pairs.targetSum / (double)pairs.count;
 
-        targetPoints.row(i) << deltas[i].target[0], deltas[i].target[2];  // Take only the x and z components
-        targetCentroid += targetPoints.row(i);
-    }
-
-    refCentroid /= (double)deltas.size();
-    targetCentroid /= (double)deltas.size();
-
-    // Center the points
-    for (size_t i = 0; i < deltas.size(); i++) {
-        refPoints.row(i) -= refCentroid;
-        targetPoints.row(i) -= targetCentroid;
-    }
-
-    // Calculate cross-covariance matrix
-    auto crossCV = refPoints.transpose() * targetPoints;
+	// Cross-covariance of the centered points: sum((r - rc) * (t - tc)^T) = sum(r * t^T) - n * rc * tc^T
+	Eigen::Matrix2d crossCV = pairs.crossSum - (double)pairs.count * refCentroid * targetCentroid.transpose();
 
     // Singular Value Decomposition (SVD)
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd(crossCV, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    Eigen::JacobiSVD<Eigen::Matrix2d> svd(crossCV, Eigen::ComputeFullU | Eigen::ComputeFullV);
 
     // Calculate 2D rotation matrix
     Eigen::Matrix2d i = Eigen::Matrix2d::Identity();
@@ -182,19 +406,90 @@ Eigen::Vector3d CalibrationCalc::CalibrateRotation() const {
 	return euler;
 }
 
+void TranslationAccumulator::Clear() {
+	count = 0;
+	refRotSum.setZero();
+	targetRotSum.setZero();
+	refTransSum.setZero();
+	targetTransSum.setZero();
+	refLocalRefTransSum.setZero();
+	targetLocalTargetTransSum.setZero();
+	for (int k = 0; k < 3; k++) {
+		refRotTargetTrans[k].setZero();
+		targetRotRefTrans[k].setZero();
+	}
+}
+
+void TranslationAccumulator::Accumulate(const Sample& sample, double sign) {
+	const Eigen::Matrix3d refRotT = sample.ref.rot.transpose();
+	const Eigen::Matrix3d targetRotT = sample.target.rot.transpose();
+
+	count += sign > 0 ? 1 : -1;
+	refRotSum += sign * refRotT;
+	targetRotSum += sign * targetRotT;
+	refTransSum += sign * sample.ref.trans;
+	targetTransSum += sign * sample.target.trans;
+	refLocalRefTransSum += sign * (refRotT * sample.ref.trans);
+	targetLocalTargetTransSum += sign * (targetRotT * sample.target.trans);
+
+	for (int k = 0; k < 3; k++) {
+		refRotTargetTrans[k] += sign * (refRotT.row(k).transpose() * sample.target.trans.transpose());
+		targetRotRefTrans[k] += sign * (targetRotT.row(k).transpose() * sample.ref.trans.transpose());
+	}
+}
+
+Eigen::Vector3d TranslationAccumulator::Solve(const Eigen::Matrix3d& rotation) const {
+	// With QA_i = ref.rot^T, QB_i = (rotation * target.rot)^T and d_i = ref.trans - rotation * target.trans,
+	// every pair contributes (QA_j - QA_i) t = QA_j d_j - QA_i d_i and the same for QB.
+	const double n = (double)count;
+
+	// sum(QA_i * rotation * target.trans) and sum(target.rot^T * rotation^T * ref.trans)
+	Eigen::Vector3d refLocalTargetTrans, targetLocalRefTrans;
+	for (int k = 0; k < 3; k++) {
+		refLocalTargetTrans(k) = rotation.cwiseProduct(refRotTargetTrans[k]).sum();
+		targetLocalRefTrans(k) = rotation.transpose().cwiseProduct(targetRotRefTrans[k]).sum();
+	}
+
+	const Eigen::Vector3d dSum = refTransSum - rotation * targetTransSum;
+	const Eigen::Matrix3d sumQA = refRotSum;
+	const Eigen::Matrix3d sumQB = targetRotSum * rotation.transpose();
+	const Eigen::Vector3d sumQAd = refLocalRefTransSum - refLocalTargetTrans;
+	const Eigen::Vector3d sumQBd = targetLocalRefTrans - targetLocalTargetTransSum;
+
+	Eigen::Matrix3d normal = 2.0 * n * n * Eigen::Matrix3d::Identity()
+		- sumQA.transpose() * sumQA
+		- sumQB.transpose() * sumQB;
+	Eigen::Vector3d rhs = 2.0 * n * dSum
+		- sumQA.transpose() * sumQAd
+		- sumQB.transpose() * sumQBd;
+
+	return normal.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(rhs);
+}
+
 Eigen::Vector3d CalibrationCalc::CalibrateTranslation(const Eigen::Matrix3d &rotation) const
+{
+	if (translationSolver == TranslationSolver::NormalEquations) {
+		return m_translationAccum.Solve(rotation);
+	}
+
+	return CalibrateTranslationPairwise(rotation);
+}
+
+Eigen::Vector3d CalibrationCalc::CalibrateTranslationPairwise(const Eigen::Matrix3d &rotation) const
 {
 	std::vector<std::pair<Eigen::Vector3d, Eigen::Matrix3d>> deltas;
+	std::vector<size_t> pairs;
 
-	for (size_t i = 0; i < m_samples.size(); i++)
+	for (size_t i = 0; i < m_samples.Size(); i++)
 	{
-		Sample s_i = m_samples[i];
+		Sample s_i = SampleAt(i);
 		s_i.target.rot = rotation * s_i.target.rot;
 		s_i.target.trans = rotation * s_i.target.trans;
 
-		for (size_t j = 0; j < i; j++)
+		SelectPairs(i, pairs);
+		for (size_t j : pairs)
 		{
-			Sample s_j = m_samples[j];
+			Sample s_j = SampleAt(j);
 			s_j.target.rot = rotation * s_j.target.rot;
 			s_j.target.trans = rotation * s_j.target.trans;
 			
@@ -241,7 +536,7 @@ void CalibrationCalc::CalibrateScaleOffset(const Eigen::Matrix3d& rotation, Eige
 namespace {
 	Pose ApplyTransform(const Pose& originalPose, const Eigen::AffineCompact3d& transform) {
 		Pose pose(originalPose);
-		pose.rot = transform.rotation() * pose.rot;
+		pose.rot = transform.linear() * pose.rot;
 		pose.trans = transform * pose.trans;
 		return pose;
 	}
@@ -267,56 +562,57 @@ Eigen::AffineCompact3d CalibrationCalc::ComputeCalibration() const {
 
 
 
-double CalibrationCalc::RetargetingErrorRMS(
-	const Eigen::Vector3d& hmdToTargetPos,
-	const Eigen::AffineCompact3d& calibration
-) const {
-	double errorAccum = 0;
-	int sampleCount = 0;
-
-	for (auto& sample : m_samples) {
-		if (!sample.valid) continue;
-
-		// Apply transformation
-		const auto updatedPose = ApplyTransform(sample.target, calibration);
-
-		const Eigen::Vector3d hmdPoseSpace = sample.ref.rot * hmdToTargetPos + sample.ref.trans;
-
-		// Compute error term
-		double error = (updatedPose.trans - hmdPoseSpace).squaredNorm();
-		errorAccum += error;
-		sampleCount++;
+/*
+ * Evaluates `count` candidate calibrations in a single sweep over the sample window. Per candidate, the sweep
+ * accumulates the sum and the sum of squares of the calibrated target position in reference-local space,
+ * ref.rot^-1 * (calibration * target.trans - ref.trans). The RMS error around the mean then follows from
+ * mean(|x|^2) - |mean(x)|^2, with x taken relative to the first sample to keep that difference well conditioned.
+ */
+void CalibrationCalc::EvaluateCandidates(const Eigen::AffineCompact3d* candidates, CandidateError* out, int count) const {
+	typedef SampleBuffer S;
+
+	Eigen::Vector3d shift[MaxCandidates], sum[MaxCandidates];
+	double sumSquares[MaxCandidates];
+	for (int k = 0; k < count; k++) {
+		shift[k].setZero();
+		sum[k].setZero();
+		sumSquares[k] = 0.0;
 	}
 
-	return sqrt(errorAccum / sampleCount);
-}
-
-Eigen::Vector3d CalibrationCalc::ComputeRefToTargetOffset(const Eigen::AffineCompact3d& calibration) const {
-	Eigen::Vector3d accum = Eigen::Vector3d::Zero();
-	int sampleCount = 0;
+	const double* column[S::ColumnCount];
+	for (int c = 0; c < S::ColumnCount; c++) {
+		column[c] = m_samples.Data((S::Column)c);
+	}
 
-	for (auto& sample : m_samples) {
-		if (!sample.valid) continue;
+	size_t sampleCount = 0;
+	for (size_t i = 0; i < m_samples.Size(); i++) {
+		if (!m_samples.IsValid(i)) continue;
 
-		// Apply transformation
-		const auto updatedPose = ApplyTransform(sample.target, calibration);
+		const Eigen::Quaterniond refRotInv = Eigen::Quaterniond(
+			column[S::RefRotW][i], column[S::RefRotX][i], column[S::RefRotY][i], column[S::RefRotZ][i]
+		).conjugate();
+		const Eigen::Vector3d refPos(column[S::RefPosX][i], column[S::RefPosY][i], column[S::RefPosZ][i]);
+		const Eigen::Vector3d targetPos(column[S::TargetPosX][i], column[S::TargetPosY][i], column[S::TargetPosZ][i]);
 
-		// Now move the transform from world to HMD space
-		const auto hmdOriginPos = updatedPose.trans - sample.ref.trans;
-		const auto hmdSpace = sample.ref.rot.inverse() * hmdOriginPos;
+		for (int k = 0; k < count; k++) {
+			const Eigen::Vector3d hmdSpace = refRotInv * (candidates[k] * targetPos - refPos);
+			if (sampleCount == 0) shift[k] = hmdSpace;
 
-		accum += hmdSpace;
+			const Eigen::Vector3d delta = hmdSpace - shift[k];
+			sum[k] += delta;
+			sumSquares[k] += delta.squaredNorm();
+		}
 		sampleCount++;
 	}
 
-	accum /= sampleCount;
-
-	return accum;
+	for (int k = 0; k < count; k++) {
+		const Eigen::Vector3d mean = sum[k] / (double)sampleCount;
+		out[k].posOffset = shift[k] + mean;
+		out[k].variance = std::max<double>(sumSquares[k] / (double)sampleCount - mean.squaredNorm(), 0.0);
+	}
 }
 
-Eigen::Vector4d CalibrationCalc::ComputeAxisVariance(
-	const Eigen::AffineCompact3d& calibration
-) const {
+Eigen::Vector4d CalibrationCalc::ComputeAxisVariance() const {
 	// We want to determine if the user rotated in enough axis to find a unique solution.
 	// It's sufficient to rotate in two axis - this is because once we constrain the mapping
 	// of those two orthogonal basis vectors, the third is determined by the cross product of
@@ -328,34 +624,7 @@ Eigen::Vector4d CalibrationCalc::ComputeAxisVariance(
 	// we expect that rotations around a single axis will have two primary components: One corresponding
 	// to the identity component, and one to the axis component. Thus, we check the variance (eigenvalue) of
 	// the third primary component to see if we've moved in two axis.
-	std::ostringstream dbgStream;
-
-	std::vector<Eigen::Vector4d> points;
-
-	Eigen::Vector4d mean = Eigen::Vector4d::Zero();
-
-	for (auto& sample : m_samples) {
-		if (!sample.valid) continue;
-
-		auto q = Eigen::Quaterniond(sample.target.rot);
-		auto point = Eigen::Vector4d(q.w(), q.x(), q.y(), q.z());
-		mean += point;
-
-		points.push_back(point);
-	}
-	mean /= (double) points.size();
-
-	// Compute covariance matrix
-	Eigen::Matrix4d covMatrix = Eigen::Matrix4d::Zero();
-
-	for (auto& point : points) {
-		for (int i = 0; i < 4; i++) {
-			for (int j = 0; j < 4; j++) {
-				covMatrix(i, j) += (point(i) - mean(i)) * (point(j) - mean(j));
-			}
-		}
-	}
-	covMatrix /= (double) points.size();
+	const Eigen::Matrix4d covMatrix = m_rotationCovariance.Covariance();
 
 	Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver;
 	solver.compute(covMatrix);
@@ -364,9 +633,16 @@ Eigen::Vector4d CalibrationCalc::ComputeAxisVariance(
 }
 
 bool CalibrationCalc::ValidateCalibration(const Eigen::AffineCompact3d &calibration, double *error, Eigen::Vector3d *posOffsetV) {
+	CandidateError candidate;
+	EvaluateCandidates(&calibration, &candidate, 1);
+
+	return ValidateCalibration(candidate, error, posOffsetV);
+}
+
+bool CalibrationCalc::ValidateCalibration(const CandidateError &candidate, double *error, Eigen::Vector3d *posOffsetV) const {
 	bool ok = true;
 
-	const auto posOffset = ComputeRefToTargetOffset(calibration);
+	const auto posOffset = candidate.posOffset;
 
 	if (posOffsetV) *posOffsetV = posOffset;
 
@@ -374,7 +650,7 @@ bool CalibrationCalc::ValidateCalibration(const Eigen::AffineCompact3d &calibrat
 	//snprintf(buf, sizeof buf, "HMD to target offset: (%.2f, %.2f, %.2f)\n", posOffset(0), posOffset(1), posOffset(2));
 	//CalCtx.Log(buf);
 
-	double rmsError = RetargetingErrorRMS(posOffset, calibration);
+	double rmsError = candidate.ErrorRMS();
 	//snprintf(buf, sizeof buf, "Position error (RMS): %.3f\n", rmsError);
 	//CalCtx.Log(buf);
 	if (rmsError > 0.1) ok = false;
@@ -396,69 +672,81 @@ bool CalibrationCalc::ValidateCalibration(const Eigen::AffineCompact3d &calibrat
 // To compute C:
 // R * S * T^-1 = C
 
-namespace {
-	class PoseAverager {
-	private:
-		Eigen::Matrix<double, 4, Eigen::Dynamic> quatAvg;
-		Eigen::Vector3d accum = Eigen::Vector3d::Zero();
-		int i = 0;
-	public:
-		PoseAverager(size_t n_samples) {
-			quatAvg.resize(4, n_samples);
-		}
+void PoseAccumulator::Clear() {
+	count = 0;
+	quatOuterSum.setZero();
+	transSum.setZero();
+}
 
-		template<typename P>
-		void Push(const P &pose) {
-			const Eigen::Quaterniond rot(pose.rotation());
-			quatAvg.col(i++) = Eigen::Vector4d(rot.w(), rot.x(), rot.y(), rot.z());
-			accum += pose.translation();
-		}
+void PoseAccumulator::Accumulate(const Pose& pose, double sign) {
+	const Eigen::Quaterniond rot(pose.rot);
+	const Eigen::Vector4d q(rot.w(), rot.x(), rot.y(), rot.z());
 
-		Eigen::AffineCompact3d Average() {
-			// https://stackoverflow.com/a/27410865/36723
-			auto quatT = quatAvg.transpose();
-			Eigen::Matrix4d quatMul = quatAvg * quatT;
-			Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver;
-			solver.compute(quatMul);
+	count += (long)sign;
+	quatOuterSum.selfadjointView<Eigen::Lower>().rankUpdate(q, sign);
+	transSum += sign * pose.trans;
+}
 
-			Eigen::Vector4d quatAvgV = solver.eigenvectors().col(3).real().normalized();
-			Eigen::Quaterniond avgQ(quatAvgV(0), quatAvgV(1), quatAvgV(2), quatAvgV(3));
-			avgQ.normalize();
+void RotationCovariance::Clear() {
+	count = 0;
+	mean.setZero();
+	m2.setZero();
+}
 
-			Eigen::AffineCompact3d pose(avgQ);
-			pose.pretranslate(accum * (1.0 / i));
+void RotationCovariance::Push(const Eigen::Vector4d& q) {
+	count++;
+	const Eigen::Vector4d delta = q - mean;
+	mean += delta / (double)count;
+	m2 += delta * (q - mean).transpose();
+}
 
-			return pose;
-		}
+void RotationCovariance::Pop(const Eigen::Vector4d& q) {
+	if (count <= 1) {
+		Clear();
+		return;
+	}
 
-		template<typename XS, typename F>
-		static Eigen::AffineCompact3d AverageFor(const XS& samples, const F& poseProvider) {
-			int sampleCount = 0;
+	count--;
+	const Eigen::Vector4d delta = q - mean;
+	mean -= delta / (double)count;
+	m2 -= (q - mean) * delta.transpose();
+}
 
-			for (auto& sample : samples) {
-				if (!sample.valid) continue;
+Eigen::Matrix4d RotationCovariance::Covariance() const {
+	if (count == 0) return Eigen::Matrix4d::Zero();
 
-				sampleCount++;
-			}
+	// The two halves of each update are not exactly transposes of each other in floating point.
+	const Eigen::Matrix4d symmetric = (m2 + m2.transpose()) * 0.5;
+	return symmetric / (double)count;
+}
 
-			PoseAverager accum(sampleCount);
+Eigen::AffineCompact3d PoseAccumulator::Average() const {
+	// https://stackoverflow.com/a/27410865/36723
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver;
+	solver.compute(quatOuterSum);
 
-			for (auto& sample : samples) {
-				if (!sample.valid) continue;
-				auto pose = poseProvider(sample);
-				accum.Push(pose);
-			}
+	Eigen::Vector4d quatAvgV = solver.eigenvectors().col(3).real().normalized();
+	Eigen::Quaterniond avgQ(quatAvgV(0), quatAvgV(1), quatAvgV(2), quatAvgV(3));
+	avgQ.normalize();
 
-			return accum.Average();
-		}
-	};
+	Eigen::AffineCompact3d pose(avgQ);
+	pose.pretranslate(transSum * (1.0 / count));
+
+	return pose;
 }
 
 // S = R^-1 * C * T
 Eigen::AffineCompact3d CalibrationCalc::EstimateRefToTargetPose(const Eigen::AffineCompact3d &calibration) const {
-	auto avg = PoseAverager::AverageFor(m_samples, [&](const auto& sample) {
-		return Eigen::Affine3d(sample.ref.ToAffine().inverse() * calibration * sample.target.ToAffine());
-	});
+	const Pose calibrationPose(calibration);
+
+	PoseAccumulator accum;
+	for (size_t i = 0; i < m_samples.Size(); i++) {
+		if (!m_samples.IsValid(i)) continue;
+
+		const Sample sample = SampleAt(i);
+		accum.Push(sample.ref.Inverse() * calibrationPose * sample.target);
+	}
+	auto avg = accum.Average();
 
 #if 0
 	Eigen::Vector3d eulerAvgQ = avg.rotation().eulerAngles(2, 1, 0) * 180.0 / EIGEN_PI;
@@ -484,14 +772,31 @@ Eigen::AffineCompact3d CalibrationCalc::EstimateRefToTargetPose(const Eigen::Aff
  * This computation can be performed even when the devices are not moving.
  */
 bool CalibrationCalc::CalibrateByRelPose(Eigen::AffineCompact3d &out) const {
-	// R * S * T^-1 = C
-	out = PoseAverager::AverageFor(m_samples, [&](const auto& sample) {
-		return Eigen::AffineCompact3d(sample.ref.ToAffine() * m_refToTargetPose * sample.target.ToAffine().inverse());
-	});
+	// The per-sample calibrations are averaged incrementally as samples enter and leave the window.
+	out = m_relPoseAccum.Average();
 
 	return true;
 }
 
+// R * S * T^-1 = C
+Pose CalibrationCalc::CalibrationByRelPose(size_t index) const {
+	const Sample sample = SampleAt(index);
+	return sample.ref * Pose(m_refToTargetPose) * sample.target.Inverse();
+}
+
+/*
+ * Every sample's contribution to m_relPoseAccum depends on the relative pose, so changing it means
+ * accumulating the window again. This happens only when a new calibration is applied.
+ */
+void CalibrationCalc::SetRefToTargetPose(const Eigen::AffineCompact3d& refToTargetPose) {
+	m_refToTargetPose = refToTargetPose;
+
+	m_relPoseAccum.Clear();
+	for (size_t i = 0; i < m_samples.Size(); i++) {
+		if (m_samples.IsValid(i)) m_relPoseAccum.Push(CalibrationByRelPose(i));
+	}
+}
+
 
 
 bool CalibrationCalc::ComputeOneshot() {
@@ -505,28 +810,32 @@ bool CalibrationCalc::ComputeOneshot() {
 		return true;
 	}
 	else {
-		CalCtx.Log("Not updating: Low-quality calibration result\n");
+		log += "Not updating: Low-quality calibration result\n";
 		return false;
 	}
 }
 
 void CalibrationCalc::ComputeInstantOffset() {
-	const auto &latestSample = m_samples.back();
+	const Sample latestSample = SampleAt(m_samples.Size() - 1);
 
 	// Apply transformation
 	const auto updatedPose = ApplyTransform(latestSample.target, m_estimatedTransformation);
 
 	// Now move the transform from world to HMD space
 	const auto hmdOriginPos = updatedPose.trans - latestSample.ref.trans;
-	const auto hmdSpace = latestSample.ref.rot.inverse() * hmdOriginPos;
+	const auto hmdSpace = latestSample.ref.rot.transpose() * hmdOriginPos;
 	
-	Metrics::posOffset_lastSample.Push(hmdSpace * 1000);
+	metrics.Push(Metrics::posOffset_lastSample, hmdSpace * 1000);
 }
 
 bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 
 
-	Metrics::RecordTimestamp();
+	metrics.RecordTimestamp();
+
+	metrics.Push(Metrics::rotationPairCount, (double)SumRotationPairs().count);
+	metrics.Push(Metrics::pairingTime, m_pairingTime * 1000);
+	m_pairingTime = 0.0;
 
 	if (lockRelativePosition) {
 		Eigen::AffineCompact3d byRelPose;
@@ -534,21 +843,31 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 		Eigen::Vector3d relPosOffset;
 		CalibrateByRelPose(byRelPose);
 		ValidateCalibration(byRelPose, &relPoseError, &relPosOffset);
-		Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
-		Metrics::error_byRelPose.Push(relPoseError * 1000);
+		metrics.Push(Metrics::posOffset_byRelPose, relPosOffset * 1000);
+		metrics.Push(Metrics::error_byRelPose, relPoseError * 1000);
 
 		m_isValid = true;
 		m_estimatedTransformation = byRelPose;
 		return true;
 	}
 
+	// The current calibration and the one implied by the relative pose are evaluated together, in one sweep over
+	// the window. A freshly solved calibration is only needed (and evaluated) if neither of them is good enough.
+	enum { Prior, RelPose, CandidateCount };
+	Eigen::AffineCompact3d candidates[CandidateCount];
+	CandidateError candidateErrors[CandidateCount];
+
+	candidates[Prior] = m_estimatedTransformation;
+	const bool haveRelPose = enableStaticRecalibration && CalibrateByRelPose(candidates[RelPose]);
+	EvaluateCandidates(candidates, candidateErrors, haveRelPose ? 2 : 1);
+
 	double priorCalibrationError = INFINITY;
 	Eigen::Vector3d priorPosOffset;
     if (m_isValid) {
-        ValidateCalibration(m_estimatedTransformation, &priorCalibrationError, &priorPosOffset);
+        ValidateCalibration(candidateErrors[Prior], &priorCalibrationError, &priorPosOffset);
 		
-        Metrics::posOffset_currentCal.Push(priorPosOffset * 1000);
-        Metrics::error_currentCal.Push(priorCalibrationError * 1000);
+        metrics.Push(Metrics::posOffset_currentCal, priorPosOffset * 1000);
+        metrics.Push(Metrics::error_currentCal, priorCalibrationError * 1000);
 
         if (priorCalibrationError < 0.005) {
             return false;
@@ -561,11 +880,12 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 	bool usingRelPose = false;
     double relPoseError = INFINITY;
 
-    if (enableStaticRecalibration && CalibrateByRelPose(byRelPose)) {
+    if (haveRelPose) {
+		byRelPose = candidates[RelPose];
 		Eigen::Vector3d relPosOffset;
-		ValidateCalibration(byRelPose, &relPoseError, &relPosOffset);
-        Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
-        Metrics::error_byRelPose.Push(relPoseError * 1000);
+		ValidateCalibration(candidateErrors[RelPose], &relPoseError, &relPosOffset);
+        metrics.Push(Metrics::posOffset_byRelPose, relPosOffset * 1000);
+        metrics.Push(Metrics::error_byRelPose, relPoseError * 1000);
 		
 		if (relPoseError < 0.010 || m_relativePosCalibrated && relPoseError < 0.025) {
 			newCalibrationValid = true;
@@ -582,14 +902,14 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
     if (!newCalibrationValid) {
         calibration = ComputeCalibration();
 
-        newVariance = ComputeAxisVariance(calibration)(1);
-		Metrics::axisIndependence.Push(newVariance);
+        newVariance = AxisVariance();
+		metrics.Push(Metrics::axisIndependence, newVariance);
 
         if (newVariance < AxisVarianceThreshold && newVariance < m_axisVariance) {
             newCalibrationValid = false;
         } else {
             newCalibrationValid = ValidateCalibration(calibration, &newError, &m_posOffset);
-            Metrics::posOffset_rawComputed.Push(m_posOffset * 1000);
+            metrics.Push(Metrics::posOffset_rawComputed, m_posOffset * 1000);
         }
 
         if (m_isValid) {
@@ -599,7 +919,7 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
             }
         }
 
-        Metrics::error_rawComputed.Push(newError * 1000);
+        metrics.Push(Metrics::error_rawComputed, newError * 1000);
 		
 		ComputeInstantOffset();
     }
@@ -611,15 +931,15 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 		char tmp[256];
 		snprintf(tmp, sizeof tmp, "Prior calibration error: %.3f (valid: %s) sct %d; new error %.3f; new better? %s\n",
 			priorCalibrationError, m_isValid ? "yes" : "no", stableCt, newError, !oldCalibrationBetter ? "yes" : "no");
-		CalCtx.Log(tmp);
+		log += tmp;
 #endif
 		
 	
 	// Now, can we use the relative pose to perform a rapid correction?
     if (!newCalibrationValid) {
 		
-        double existingPoseErrorUsingRelPosition = RetargetingErrorRMS(m_refToTargetPose.translation(), m_estimatedTransformation);
-        Metrics::error_currentCalRelPose.Push(existingPoseErrorUsingRelPosition * 1000);
+        double existingPoseErrorUsingRelPosition = candidateErrors[Prior].ErrorRMS(m_refToTargetPose.translation());
+        metrics.Push(Metrics::error_currentCalRelPose, existingPoseErrorUsingRelPosition * 1000);
 		if (relPoseError * threshold < existingPoseErrorUsingRelPosition || newCalibrationValid && relPoseError < newError) {
 		newCalibrationValid = true;
         usingRelPose = true;
@@ -632,12 +952,12 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 		lerp = m_isValid;
 		m_relativePosCalibrated = m_relativePosCalibrated || newError < 0.005;
 		if (!m_isValid) {
-			CalCtx.Log("Applying initial transformation...");
+			log += "Applying initial transformation...";
 		}
 		else if (m_relativePosCalibrated) {
-			CalCtx.Log("Applying updated transformation...");
+			log += "Applying updated transformation...";
 		} else {
-			CalCtx.Log("Applying temporary transformation...");
+			log += "Applying temporary transformation...";
 		}
 		
 		m_isValid = true;
@@ -645,10 +965,10 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold) {
 		m_axisVariance = newVariance;
 
 		if (!usingRelPose) {
-			m_refToTargetPose = EstimateRefToTargetPose(m_estimatedTransformation);
+			SetRefToTargetPose(EstimateRefToTargetPose(m_estimatedTransformation));
 		}
 
-		Metrics::calibrationApplied.Push(!usingRelPose);
+		metrics.Push(Metrics::calibrationApplied, !usingRelPose);
 
 		return true;
 	}
@@ -5,6 +5,10 @@
 #include <vector>
 #include <deque>
 #include <iostream>
+#include <random>
+
+#include "CalibrationMetrics.h"
+#include "SampleBuffer.h"
 
 struct Pose
 {
@@ -12,8 +16,11 @@ struct Pose
 	Eigen::Vector3d trans;
 
 	Pose() { }
-	Pose(const Eigen::AffineCompact3d& transform) {
-		rot = transform.rotation();
+	Pose(const Eigen::Matrix3d& rot, const Eigen::Vector3d& trans) : rot(rot), trans(trans) { }
+	Pose(const Eigen::Quaterniond& rot, const Eigen::Vector3d& trans) : rot(rot.toRotationMatrix()), trans(trans) { }
+	// The transform must be rigid; its linear part is taken as the rotation as is.
+	explicit Pose(const Eigen::AffineCompact3d& transform) {
+		rot = transform.linear();
 		trans = transform.translation();
 	}
 	
@@ -32,20 +39,21 @@ struct Pose
 	}
 	Pose(double x, double y, double z) : trans(Eigen::Vector3d(x, y, z)) { }
 
-	Eigen::Matrix4d ToAffine() const {
-		Eigen::Matrix4d matrix = Eigen::Matrix4d::Identity();
-
-		for (int i = 0; i < 3; i++) {
-			for (int j = 0; j < 3; j++) {
-				matrix(i, j) = rot(i, j);
-			}
-			matrix(i, 3) = trans(i);
-		}
-
-		return matrix;
+	/* Closed-form inverse of a rigid transform: (R, t)^-1 = (R^T, -R^T * t). */
+	Pose Inverse() const {
+		const Eigen::Matrix3d invRot = rot.transpose();
+		return Pose(invRot, -(invRot * trans));
 	}
 };
 
+inline Pose operator*(const Pose& a, const Pose& b) {
+	return Pose(a.rot * b.rot, a.rot * b.trans + a.trans);
+}
+
+inline Eigen::Vector3d operator*(const Pose& a, const Eigen::Vector3d& p) {
+	return a.rot * p + a.trans;
+}
+
 struct Sample
 {
 	Pose ref, target;
@@ -54,9 +62,172 @@ struct Sample
 	Sample(Pose ref, Pose target) : valid(true), ref(ref), target(target) { }
 };
 
+/*
+ * Running sums over the sample window from which the normal equations of the pairwise translation
+ * system (see CalibrationCalc::CalibrateTranslationPairwise) can be rebuilt for any calibration rotation.
+ * Every pairwise sum over i < j reduces to n * sum(X_i^T Y_i) - sum(X_i)^T sum(Y_i), and the rotation
+ * only enters bilinearly, so a handful of 3x3 sums is enough to solve in constant time.
+ */
+struct TranslationAccumulator
+{
+	TranslationAccumulator() { Clear(); }
+
+	void Push(const Sample& sample) { Accumulate(sample, 1.0); }
+	void Pop(const Sample& sample) { Accumulate(sample, -1.0); }
+	void Clear();
+
+	Eigen::Vector3d Solve(const Eigen::Matrix3d& rotation) const;
+
+private:
+	long count;
+	Eigen::Matrix3d refRotSum, targetRotSum; // sum(ref.rot^T), sum(target.rot^T)
+	Eigen::Vector3d refTransSum, targetTransSum;
+	Eigen::Vector3d refLocalRefTransSum; // sum(ref.rot^T * ref.trans)
+	Eigen::Vector3d targetLocalTargetTransSum; // sum(target.rot^T * target.trans)
+	// Row k of each sample's rotation^T, outer product with the other device's translation.
+	Eigen::Matrix3d refRotTargetTrans[3], targetRotRefTrans[3];
+
+	void Accumulate(const Sample& sample, double sign);
+};
+
+/*
+ * Running average of a set of rigid poses that supports removing poses again. The rotations are averaged
+ * with Markley's method, which only needs the sum of the quaternion outer products q * q^T: the average is
+ * the eigenvector of that 4x4 matrix with the largest eigenvalue. Pushing and popping are constant time and
+ * never allocate; the eigen-decomposition only runs in Average().
+ */
+struct PoseAccumulator
+{
+	PoseAccumulator() { Clear(); }
+
+	void Push(const Pose& pose) { Accumulate(pose, 1.0); }
+	void Pop(const Pose& pose) { Accumulate(pose, -1.0); }
+	void Clear();
+
+	long Count() const { return count; }
+	Eigen::AffineCompact3d Average() const;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	long count;
+	Eigen::Matrix4d quatOuterSum; // sum(q * q^T), with q = (w, x, y, z)
+	Eigen::Vector3d transSum;
+
+	void Accumulate(const Pose& pose, double sign);
+};
+
+/*
+ * Mean and covariance of the target rotation quaternions in the window, maintained with Welford's online
+ * update. Removing a sample runs the same update backwards, so the covariance follows the window as it
+ * slides without ever revisiting the samples.
+ */
+struct RotationCovariance
+{
+	RotationCovariance() { Clear(); }
+
+	void Push(const Eigen::Vector4d& q);
+	void Pop(const Eigen::Vector4d& q);
+	void Clear();
+
+	long Count() const { return count; }
+	Eigen::Matrix4d Covariance() const;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	long count;
+	Eigen::Vector4d mean;
+	Eigen::Matrix4d m2; // sum((q - mean) * (q - mean)^T)
+};
+
+/*
+ * Sums over the valid delta-rotation pairs formed between one sample and every sample pushed after it,
+ * projected onto the XZ plane used by CalibrateRotation. Summing the records of all samples in the window
+ * gives everything the Kabsch step needs without revisiting any pair.
+ */
+struct RotationPairStats
+{
+	long count = 0;
+	Eigen::Vector2d refSum = Eigen::Vector2d::Zero(), targetSum = Eigen::Vector2d::Zero();
+	Eigen::Matrix2d crossSum = Eigen::Matrix2d::Zero(); // sum(ref * target^T)
+
+	void Add(const Eigen::Vector3d& refAxis, const Eigen::Vector3d& targetAxis) {
+		const Eigen::Vector2d ref(refAxis(0), refAxis(2)), target(targetAxis(0), targetAxis(2));
+		count++;
+		refSum += ref;
+		targetSum += target;
+		crossSum += ref * target.transpose();
+	}
+
+	RotationPairStats& operator+=(const RotationPairStats& other) {
+		count += other.count;
+		refSum += other.refSum;
+		targetSum += other.targetSum;
+		crossSum += other.crossSum;
+		return *this;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/*
+ * Valid delta-rotation axis pairs formed between a new sample and the older samples of the window, as emitted
+ * by the batch kernel in PushSample. Sized to the window up front so that pushing a sample does not allocate.
+ */
+struct DeltaAxisBuffer
+{
+	std::vector<size_t> index; // window index of the older sample
+	Eigen::Matrix3Xd ref, target; // normalized rotation axes, one column per pair
+	size_t count = 0;
+
+	void Reserve(size_t capacity) {
+		index.resize(capacity);
+		ref.resize(3, (Eigen::Index)capacity);
+		target.resize(3, (Eigen::Index)capacity);
+		count = 0;
+	}
+
+	void Push(size_t i, const Eigen::Vector3d& refAxis, const Eigen::Vector3d& targetAxis) {
+		index[count] = i;
+		ref.col((Eigen::Index)count) = refAxis;
+		target.col((Eigen::Index)count) = targetAxis;
+		count++;
+	}
+};
+
 class CalibrationCalc {
 public:
 	static const double AxisVarianceThreshold;
+	static const size_t DefaultWindowSize = 100;
+
+	enum class TranslationSolver {
+		// Builds every sample pair into one dense system and solves it by SVD.
+		PairwiseSVD,
+		// Solves the normal equations of the same system from sums kept up to date by PushSample/ShiftSample.
+		NormalEquations
+	};
+	TranslationSolver translationSolver = TranslationSolver::NormalEquations;
+
+	enum class RotationPairKernel {
+		// Rebuilds both rotation matrices and runs DeltaRotationSamples for every pair. The replay project's
+		// kernel-equivalence-test checks that Batch agrees with it.
+		Scalar,
+		// Compares quaternions from the sample buffer a block at a time, without matrices or acos.
+		Batch
+	};
+	RotationPairKernel rotationPairKernel = RotationPairKernel::Batch;
+
+	enum class PairSelection {
+		// Pairs every sample with every older sample in the window.
+		All,
+		// Pairs every sample with pairBudget older samples, drawn at random from evenly sized strata of the window.
+		RandomBudget,
+		// Draws a larger random candidate set and balances the pairBudget chosen pairs across relative rotation angles.
+		Stratified
+	};
+	PairSelection pairSelection = PairSelection::All;
+	size_t pairBudget = 64;
 
 	bool enableStaticRecalibration;
 	bool lockRelativePosition = false;
@@ -87,7 +258,7 @@ public:
 
 	void setRelativeTransformation(const Eigen::AffineCompact3d transform, bool calibrated)
 	{
-		m_refToTargetPose = transform;
+		SetRefToTargetPose(transform);
 		m_relativePosCalibrated = calibrated;
 	}
 
@@ -98,14 +269,38 @@ public:
 	bool ComputeIncremental(bool &lerp, double threshold);
 
 	size_t SampleCount() const {
-		return m_samples.size();
+		return m_samples.Size();
 	}
 
-	void ShiftSample() {
-		if (!m_samples.empty()) m_samples.pop_front();
+	/*
+	 * Sets the number of samples kept in the window. Once the window is full, PushSample evicts the oldest
+	 * sample. Shrinking the window keeps the newest samples.
+	 */
+	void SetWindowSize(size_t size);
+	size_t WindowSize() const {
+		return m_samples.Capacity();
 	}
 
-	CalibrationCalc() : m_isValid(false), m_calcCycle(0), enableStaticRecalibration(true) {}
+	void ShiftSample();
+
+	/*
+	 * Second principal variance of the target rotations in the window (see ComputeAxisVariance). Kept up to date
+	 * as samples are pushed and shifted, so it is cheap enough to poll while samples are still being collected.
+	 */
+	double AxisVariance() const {
+		return ComputeAxisVariance()(1);
+	}
+
+	CalibrationCalc() : m_isValid(false), m_calcCycle(0), enableStaticRecalibration(true) {
+		SetWindowSize(DefaultWindowSize);
+	}
+
+	/*
+	 * Log text and metrics recorded by the computations since the caller last drained them. CalibrationCalc
+	 * may run off the UI thread, so it never writes to CalCtx or the Metrics series directly.
+	 */
+	std::string log;
+	Metrics::PendingSamples metrics;
 
 	// Debug fields
 	Eigen::Vector3d m_posOffset;
@@ -123,22 +318,59 @@ private:
 	 */
 	Eigen::AffineCompact3d m_refToTargetPose = Eigen::AffineCompact3d::Identity();
 
-	std::deque<Sample> m_samples;
+	SampleBuffer m_samples;
+	// Indexed by ring slot of m_samples: each entry holds the pairs its sample forms with every later sample.
+	std::vector<RotationPairStats, Eigen::aligned_allocator<RotationPairStats>> m_rotationPairs;
+	TranslationAccumulator m_translationAccum;
+	// Calibrations implied by m_refToTargetPose for every valid sample in the window (see CalibrateByRelPose).
+	PoseAccumulator m_relPoseAccum;
+	RotationCovariance m_rotationCovariance;
+	DeltaAxisBuffer m_deltaAxes;
+	std::vector<size_t> m_pairIndices;
+	mutable std::mt19937 m_pairRng;
+	double m_pairingTime = 0.0;
+
+	Sample SampleAt(size_t index) const;
+	void SelectPairs(size_t sample, std::vector<size_t>& out) const;
+	RotationPairStats SumRotationPairs() const;
 
 	Eigen::Vector3d CalibrateRotation() const;
 	Eigen::Vector3d CalibrateTranslation(const Eigen::Matrix3d &rotation) const;
+	Eigen::Vector3d CalibrateTranslationPairwise(const Eigen::Matrix3d &rotation) const;
 	void CalibrateScaleOffset(const Eigen::Matrix3d &rotation, Eigen::Vector3d* out_scaleOffset, float* out_scaleFactor) const;
 
 	Eigen::AffineCompact3d ComputeCalibration() const;
 
-	double RetargetingErrorRMS(const Eigen::Vector3d& hmdToTargetPos, const Eigen::AffineCompact3d& calibration) const;
-	Eigen::Vector3d ComputeRefToTargetOffset(const Eigen::AffineCompact3d& calibration) const;
+	/*
+	 * How well one candidate calibration explains the sample window: the mean position of the calibrated target
+	 * in the reference device's local space, and the mean squared distance of the samples from that mean.
+	 */
+	struct CandidateError
+	{
+		Eigen::Vector3d posOffset = Eigen::Vector3d::Zero();
+		double variance = 0.0;
+
+		double ErrorRMS() const {
+			return sqrt(variance);
+		}
+
+		// RMS distance from a fixed offset instead of the mean: mean(|x - h|^2) = variance + |mean - h|^2
+		double ErrorRMS(const Eigen::Vector3d& offset) const {
+			return sqrt(variance + (posOffset - offset).squaredNorm());
+		}
+	};
+
+	static const int MaxCandidates = 4;
+	void EvaluateCandidates(const Eigen::AffineCompact3d* candidates, CandidateError* out, int count) const;
 
-	Eigen::Vector4d ComputeAxisVariance(const Eigen::AffineCompact3d& calibration) const;
+	Eigen::Vector4d ComputeAxisVariance() const;
 
 	bool ValidateCalibration(const Eigen::AffineCompact3d& calibration, double *errorOut = nullptr, Eigen::Vector3d* posOffsetV = nullptr);
+	bool ValidateCalibration(const CandidateError& candidate, double *errorOut = nullptr, Eigen::Vector3d* posOffsetV = nullptr) const;
 	void ComputeInstantOffset();
 
 	Eigen::AffineCompact3d EstimateRefToTargetPose(const Eigen::AffineCompact3d& calibration) const;
+	Pose CalibrationByRelPose(size_t index) const;
+	void SetRefToTargetPose(const Eigen::AffineCompact3d& refToTargetPose);
 	bool CalibrateByRelPose(Eigen::AffineCompact3d &out) const;
 };
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <implot/implot.h>
 #include "CalibrationCalc.h"
 #include "CalibrationMetrics.h"
+#include "Calibration.h"
 #include "UserInterface.h"
 // ImPlotPoint (*ImPlotGetter)(void* user_data, int idx);
 namespace {
@@ -221,6 +222,21 @@ namespace {
 		}
 	}
 
+	void G_SamplePairs() {
+		if (ImPlot::BeginPlot("##Sample Pairs")) {
+			ImPlot::SetupAxes(NULL, "pairs", 0, ImPlotAxisFlags_AutoFit | ImPlotAxisFlags_RangeFit);
+			ImPlot::SetupAxis(ImAxis_Y2, "ms", ImPlotAxisFlags_AuxDefault | ImPlotAxisFlags_AutoFit | ImPlotAxisFlags_RangeFit);
+			SetupXAxis();
+
+			AddApplyTicks();
+
+			PlotLineG("Rotation pairs", Metrics::rotationPairCount);
+			ImPlot::SetAxes(ImAxis_X1, ImAxis_Y2);
+			PlotLineG("Pairing time", Metrics::pairingTime);
+			ImPlot::EndPlot();
+		}
+	}
+
 	void G_AxisVariance() {
 		static bool firstrun = true;
 		static ImPlotColormap axisVarianceColormap;
@@ -287,6 +303,72 @@ namespace {
 		}
 	}
 
+	protocol::DriverStatsShmem::DeviceStats hookStats;
+	uint64_t hookCallsAtLastRate[vr::k_unMaxTrackedDeviceCount];
+	double hookCallRate[vr::k_unMaxTrackedDeviceCount];
+	double lastHookRateTime = -INFINITY;
+
+	void HookLatencyCells(const protocol::LatencyHistogram::Counts& counts) {
+		const double fractions[] = { 0.5, 0.99, 0.999 };
+		for (double fraction : fractions) {
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", counts.Percentile(fraction) / 1000.0);
+		}
+	}
+
+	/* Not a graph: a table of what the driver's pose hook costs each device, read from the driver's statistics. */
+	void G_DriverHookLatency() {
+		const auto& driverStats = DriverStats();
+		if (!driverStats) {
+			ImGui::TextDisabled("Driver statistics unavailable");
+			return;
+		}
+
+		// Call rates are averaged over a second, so that they do not flicker from frame to frame.
+		const double now = Metrics::timestamp();
+		const bool updateRates = now - lastHookRateTime >= 1.0;
+
+		if (!ImGui::BeginTable("##DriverHookLatency", 8, ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchSame,
+			ImVec2(-1, ImPlot::GetStyle().PlotDefaultSize.y))) {
+			return;
+		}
+
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Dev");
+		ImGui::TableSetupColumn("Hz");
+		ImGui::TableSetupColumn("Hook p50");
+		ImGui::TableSetupColumn("p99");
+		ImGui::TableSetupColumn("p99.9");
+		ImGui::TableSetupColumn("Handle p50");
+		ImGui::TableSetupColumn("p99");
+		ImGui::TableSetupColumn("p99.9");
+		ImGui::TableHeadersRow();
+
+		for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; id++) {
+			const uint64_t calls = driverStats.Calls(id);
+			if (updateRates) {
+				hookCallRate[id] = lastHookRateTime == -INFINITY ? 0 : (calls - hookCallsAtLastRate[id]) / (now - lastHookRateTime);
+				hookCallsAtLastRate[id] = calls;
+			}
+			if (calls == 0) continue;
+
+			driverStats.Read(id, hookStats);
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%u", id);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", hookCallRate[id]);
+			HookLatencyCells(hookStats.hook);
+			HookLatencyCells(hookStats.handle);
+		}
+
+		ImGui::EndTable();
+
+		if (updateRates) lastHookRateTime = now;
+		ImGui::TextDisabled("Microseconds, since the driver was loaded; Hook includes SteamVR's own handling of the pose");
+	}
+
 	const struct GraphInfo graphs[] = {
 		{ "Position Error", G_PosOffset_PosError },
 		{ "Axis Variance", G_AxisVariance },
@@ -294,7 +376,9 @@ namespace {
 		{ "Offset: Current Calibration", G_PosOffset_CurrentCal },
 		{ "Offset: Last Sample", G_PosOffset_LastSample },
 		{ "Offset: By Rel Pose", G_PosOffset_ByRelPose },
-		{ "Processing time", G_ComputationTime }
+		{ "Processing time", G_ComputationTime },
+		{ "Sample pairs", G_SamplePairs },
+		{ "Driver hook latency", G_DriverHookLatency }
 	};
 
 	const int N_GRAPHS = sizeof(graphs) / sizeof(graphs[0]);
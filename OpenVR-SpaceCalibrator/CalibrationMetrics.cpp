@@ -15,19 +15,24 @@ namespace Metrics {
 	TimeSeries<double> error_rawComputed, error_currentCal, error_byRelPose, error_currentCalRelPose;
 	TimeSeries<double> axisIndependence;
 	TimeSeries<double> computationTime;
+	// Rotation pairs in the window, and time spent forming pairs (ms) since the previous solve
+	TimeSeries<double> rotationPairCount, pairingTime;
 
 	// true - full calibration, false - static calibration
 	TimeSeries<bool> calibrationApplied;
 
 	double timestamp() {
-		static long long ts_start = ~0LL;
+		// Also called from the calibration worker thread; the static initializer runs exactly once.
+		static const long long ts_start = [] {
+			LARGE_INTEGER start;
+			QueryPerformanceCounter(&start);
+			return start.QuadPart;
+		}();
 		
 		LARGE_INTEGER ts, freq;
 		QueryPerformanceCounter(&ts);
 		QueryPerformanceFrequency(&freq);
 
-		if (ts_start == ~0LL) ts_start = ts.QuadPart;
-
 		ts.QuadPart -= ts_start;
 
 		return ts.QuadPart / (double)freq.QuadPart;
@@ -73,6 +78,8 @@ namespace Metrics {
 		TS_FIELD(error_currentCalRelPose),
 		TS_FIELD(axisIndependence),
 		TS_FIELD(computationTime),
+		TS_FIELD(rotationPairCount),
+		TS_FIELD(pairingTime),
 
 		{
 			"calibrationApplied", 
@@ -90,8 +97,8 @@ namespace Metrics {
 	};
 	
 	
-	static void ClearOldLogs(const std::wstring& path) {
-		std::wstring search_path = path + L"\\spacecal_log.*.txt";
+	static void ClearOldLogs(const std::wstring& path, const wchar_t* prefix, const wchar_t* extension) {
+		std::wstring search_path = path + L"\\" + prefix + L".*" + extension;
 		WIN32_FIND_DATA find_data;
 
 		SYSTEMTIME st_now;
@@ -119,11 +126,11 @@ namespace Metrics {
 		}
 	}
 
-	static bool OpenLogFile() {
+	std::wstring NewLogFilePath(const wchar_t* prefix, const wchar_t* extension, bool keepOldFiles) {
 		PWSTR RootPath = NULL;
 		if (S_OK != SHGetKnownFolderPath(FOLDERID_LocalAppDataLow, 0, NULL, &RootPath)) {
 			CoTaskMemFree(RootPath);
-			return false;
+			return std::wstring();
 		}
 
 		std::wstring path(RootPath);
@@ -131,32 +138,44 @@ namespace Metrics {
 		
 		path += LR"(\OpenVR-SpaceCalibrator)";
 		if (CreateDirectoryW(path.c_str(), 0) == 0 && GetLastError() != ERROR_ALREADY_EXISTS) {
-			return false;
+			return std::wstring();
 		}
 
 		path += LR"(\Logs)";
 		if (CreateDirectoryW(path.c_str(), 0) == 0 && GetLastError() != ERROR_ALREADY_EXISTS) {
-			return false;
+			return std::wstring();
 		}
 
-		ClearOldLogs(path);
+		if (!keepOldFiles) {
+			ClearOldLogs(path, prefix, extension);
+		}
 
 		SYSTEMTIME now;
 		GetSystemTime(&now);
 
 		size_t dateBufLen = GetDateFormatW(LOCALE_USER_DEFAULT, 0, &now, L"yyyy-MM-dd", NULL, 0);
 		std::vector<WCHAR> dateBuf(dateBufLen);
-		if (!GetDateFormatEx(LOCALE_NAME_INVARIANT, 0, &now, L"yyyy-MM-dd", &dateBuf[0], dateBufLen, NULL)) return false;
+		if (!GetDateFormatEx(LOCALE_NAME_INVARIANT, 0, &now, L"yyyy-MM-dd", &dateBuf[0], dateBufLen, NULL)) return std::wstring();
 		
 		size_t timeBufLen = GetTimeFormatW(LOCALE_USER_DEFAULT, 0, &now, L"HH-mm-ss", NULL, 0);
 		std::vector<WCHAR> timeBuf(timeBufLen);
-		if (!GetTimeFormatEx(LOCALE_NAME_INVARIANT, 0, &now, L"HH-mm-ss", &timeBuf[0], timeBufLen)) return false;
+		if (!GetTimeFormatEx(LOCALE_NAME_INVARIANT, 0, &now, L"HH-mm-ss", &timeBuf[0], timeBufLen)) return std::wstring();
 
-		path += LR"(\spacecal_log.)";
+		path += L"\\";
+		path += prefix;
+		path += L".";
 		path += &dateBuf[0];
 		path += L"T";
 		path += &timeBuf[0];
-		path += L".txt";
+		path += extension;
+		return path;
+	}
+
+	static bool OpenLogFile() {
+		const std::wstring path = NewLogFilePath(L"spacecal_log", L".txt");
+		if (path.empty()) {
+			return false;
+		}
 
 		logFile.open(path);
 		if (logFile.fail()) {
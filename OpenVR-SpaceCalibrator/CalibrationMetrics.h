@@ -1,7 +1,10 @@
 #pragma once
 
 #include <deque>
+#include <functional>
+#include <string>
 #include <utility>
+#include <vector>
 #include <Eigen/Dense>
 
 namespace Metrics {
@@ -15,6 +18,8 @@ namespace Metrics {
 		std::deque<std::pair<double, T>> Data;
 		
 	public:
+		typedef T value_type;
+
 		const std::deque<std::pair<double, T>> &data() const { return Data; }
 
 		void Push(const T& data) {
@@ -30,7 +35,7 @@ namespace Metrics {
 		const std::pair<double, T>& operator[](int index) const { return Data[index]; }
 
 		const T& last() const {
-			static const T fallback;
+			static const T fallback = T();
 			return Data.size() > 0 ? Data.back().second : fallback;
 		}
 
@@ -40,6 +45,41 @@ namespace Metrics {
 	};
 
 
+	/*
+	 * Time series samples recorded away from the UI thread. They are staged with the timestamp that was current
+	 * when they were recorded, and pushed into their series by Flush, which must run on the UI thread.
+	 */
+	class PendingSamples {
+		std::vector<std::pair<double, std::function<void()>>> Pending;
+		double Now = 0;
+
+	public:
+		void RecordTimestamp() {
+			Now = timestamp();
+		}
+
+		template<typename T>
+		void Push(TimeSeries<T>& series, const typename TimeSeries<T>::value_type& data) {
+			TimeSeries<T>* target = &series;
+			T value = data;
+			Pending.push_back(std::make_pair(Now, [target, value]() { target->Push(value); }));
+		}
+
+		void Flush() {
+			for (auto& sample : Pending) {
+				CurrentTime = sample.first;
+				sample.second();
+			}
+			Pending.clear();
+		}
+
+		void Clear() {
+			Pending.clear();
+		}
+
+		bool empty() const { return Pending.empty(); }
+	};
+
 	extern TimeSeries<Eigen::Vector3d> posOffset_rawComputed; // , rotOffset_rawComputed;
 	extern TimeSeries<Eigen::Vector3d> posOffset_currentCal; // , rotOffset_currentCal;
 	extern TimeSeries<Eigen::Vector3d> posOffset_lastSample; // , rotOffset_lastSample;
@@ -48,6 +88,7 @@ namespace Metrics {
 	extern TimeSeries<double> error_rawComputed, error_currentCal, error_byRelPose, error_currentCalRelPose;
 	extern TimeSeries<double> axisIndependence;
 	extern TimeSeries<double> computationTime;
+	extern TimeSeries<double> rotationPairCount, pairingTime;
 
 	extern TimeSeries<bool> calibrationApplied;
 
@@ -55,4 +96,11 @@ namespace Metrics {
 
 	void WriteLogAnnotation(const char* s);
 	void WriteLogEntry();
+
+	/*
+	 * Path for a new file named prefix.<date>T<time><extension> in the log directory, which is created if needed.
+	 * Unless keepOldFiles is set, files of the same kind that are older than a day are deleted. Returns an empty
+	 * string on failure.
+	 */
+	std::wstring NewLogFilePath(const wchar_t* prefix, const wchar_t* extension, bool keepOldFiles = false);
 }
\ No newline at end of file
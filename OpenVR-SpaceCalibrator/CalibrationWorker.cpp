@@ -0,0 +1,150 @@
+#include "CalibrationWorker.h"
+
+CalibrationWorker::CalibrationWorker() {
+	m_thread = std::thread(&CalibrationWorker::Run, this);
+}
+
+CalibrationWorker::~CalibrationWorker() {
+	{
+		std::lock_guard<std::mutex> lock(m_inboxMutex);
+		m_stop = true;
+	}
+	m_inboxSignal.notify_one();
+	m_thread.join();
+}
+
+void CalibrationWorker::Clear() {
+	m_epoch++;
+	m_valid = false;
+
+	Command command;
+	command.type = Command::ClearWindow;
+	Enqueue(command);
+}
+
+void CalibrationWorker::SetRelativeTransformation(const Eigen::AffineCompact3d& transform, bool calibrated) {
+	Command command;
+	command.type = Command::SetRelative;
+	command.transform = transform;
+	command.calibrated = calibrated;
+	Enqueue(command);
+}
+
+void CalibrationWorker::PushSample(const Sample& sample, const Settings& settings) {
+	Command command;
+	command.type = Command::Push;
+	command.sample = sample;
+	command.settings = settings;
+	Enqueue(command);
+}
+
+CalibrationWorker::Result* CalibrationWorker::PollResult() {
+	if (!m_results.Update()) return nullptr;
+
+	Result& result = m_results.ReadBuffer();
+	if (result.epoch != m_epoch) return nullptr;
+
+	m_valid = result.valid;
+	return &result;
+}
+
+void CalibrationWorker::Enqueue(const Command& command) {
+	{
+		std::lock_guard<std::mutex> lock(m_inboxMutex);
+		m_inbox.push_back(command);
+		m_inbox.back().epoch = m_epoch;
+	}
+	m_inboxSignal.notify_one();
+}
+
+void CalibrationWorker::Run() {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_inboxMutex);
+			m_inboxSignal.wait(lock, [this] { return m_stop || !m_inbox.empty(); });
+			if (m_stop) return;
+
+			m_processing.swap(m_inbox);
+		}
+
+		bool pushed = false;
+		Settings settings;
+
+		for (const auto& command : m_processing) {
+			switch (command.type) {
+			case Command::ClearWindow:
+				m_calc.Clear();
+				m_calc.log.clear();
+				m_calc.metrics.Clear();
+				m_workerEpoch = command.epoch;
+				break;
+
+			case Command::SetRelative:
+				m_calc.setRelativeTransformation(command.transform, command.calibrated);
+				break;
+
+			case Command::Push:
+				settings = command.settings;
+				m_calc.SetWindowSize(settings.windowSize);
+				m_calc.pairSelection = settings.pairSelection;
+				m_calc.pairBudget = settings.pairBudget;
+				m_calc.PushSample(command.sample);
+				pushed = true;
+				break;
+			}
+		}
+		m_processing.clear();
+
+		if (pushed && m_calc.SampleCount() >= settings.windowSize) {
+			Solve(settings);
+		}
+
+		m_sampleCount.store(m_calc.SampleCount(), std::memory_order_relaxed);
+		m_axisVariance.store(m_calc.AxisVariance(), std::memory_order_relaxed);
+	}
+}
+
+void CalibrationWorker::Solve(const Settings& settings) {
+	m_calc.metrics.RecordTimestamp();
+	const double startTime = Metrics::timestamp();
+
+	bool lerp = false;
+	if (settings.continuous) {
+		m_calc.enableStaticRecalibration = settings.enableStaticRecalibration;
+		m_calc.lockRelativePosition = settings.lockRelativePosition;
+		m_calc.ComputeIncremental(lerp, settings.threshold);
+	}
+	else {
+		m_calc.enableStaticRecalibration = false;
+		m_calc.ComputeOneshot();
+	}
+
+	m_calc.metrics.Push(Metrics::computationTime, (Metrics::timestamp() - startTime) * 1000.0);
+
+	Result& result = m_results.WriteBuffer();
+	result.epoch = m_workerEpoch;
+	result.continuous = settings.continuous;
+	result.valid = m_calc.isValid();
+	result.transformation = m_calc.Transformation();
+	result.eulerRotation = m_calc.EulerRotation();
+	result.relativeTransformation = m_calc.RelativeTransformation();
+	result.relativeCalibrated = m_calc.isRelativeTransformationCalibrated();
+
+	// The write buffer may still hold the log and metrics of a result the UI never picked up; drop those.
+	result.log.swap(m_calc.log);
+	m_calc.log.clear();
+	std::swap(result.metrics, m_calc.metrics);
+	m_calc.metrics.Clear();
+
+	m_results.Publish();
+
+	if (settings.continuous) {
+		size_t drop_samples = settings.windowSize / 10;
+		for (size_t i = 0; i < drop_samples; i++) {
+			m_calc.ShiftSample();
+		}
+	}
+	else {
+		m_calc.Clear();
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CalibrationCalc.h"
+#include "CalibrationMetrics.h"
+
+/*
+ * Single-producer, single-consumer triple buffer. The writer fills WriteBuffer() and publishes it, the reader
+ * takes the most recently published buffer with Update(). Neither side ever waits for the other; results that
+ * are published twice before the reader looks are replaced by the newer one.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+	T& WriteBuffer() { return m_buffers[m_write]; }
+
+	void Publish() {
+		m_write = m_middle.exchange(m_write | Dirty, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	/* Returns true if a buffer was published since the last call, in which case ReadBuffer() now holds it. */
+	bool Update() {
+		if (!(m_middle.load(std::memory_order_relaxed) & Dirty)) return false;
+
+		m_read = m_middle.exchange(m_read, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+
+	T& ReadBuffer() { return m_buffers[m_read]; }
+
+private:
+	static const int Dirty = 4, IndexMask = 3;
+
+	T m_buffers[3];
+	int m_write = 0, m_read = 1;
+	std::atomic<int> m_middle { 2 };
+};
+
+/*
+ * Runs the calibration solves on a dedicated thread, so that a slow solve never stalls the overlay or the UI.
+ *
+ * The UI thread only enqueues commands (samples, resets) and polls for results. Commands collect in an inbox
+ * guarded by a mutex, which the worker swaps with its own, drained buffer in one step. Results come back
+ * through a lock-free triple buffer, together with the log text and metrics recorded while solving.
+ */
+class CalibrationWorker
+{
+public:
+	struct Settings
+	{
+		size_t windowSize = CalibrationCalc::DefaultWindowSize;
+		CalibrationCalc::PairSelection pairSelection = CalibrationCalc::PairSelection::All;
+		size_t pairBudget = 64;
+
+		bool continuous = false;
+		bool enableStaticRecalibration = false;
+		bool lockRelativePosition = false;
+		double threshold = 1.5;
+	};
+
+	struct Result
+	{
+		uint64_t epoch = 0;
+		bool continuous = false;
+
+		bool valid = false;
+		Eigen::AffineCompact3d transformation = Eigen::AffineCompact3d::Identity();
+		Eigen::Vector3d eulerRotation = Eigen::Vector3d::Zero();
+		Eigen::AffineCompact3d relativeTransformation = Eigen::AffineCompact3d::Identity();
+		bool relativeCalibrated = false;
+
+		std::string log;
+		Metrics::PendingSamples metrics;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	CalibrationWorker();
+	~CalibrationWorker();
+
+	CalibrationWorker(const CalibrationWorker&) = delete;
+	CalibrationWorker& operator=(const CalibrationWorker&) = delete;
+
+	/* Discards the sample window, along with any result still in flight that was computed from it. */
+	void Clear();
+	void SetRelativeTransformation(const Eigen::AffineCompact3d& transform, bool calibrated);
+	void PushSample(const Sample& sample, const Settings& settings);
+
+	/* Returns the result of a solve that finished since the last call, or null if there is none. */
+	Result* PollResult();
+
+	/* Whether the last result picked up by PollResult since the last Clear was valid. */
+	bool IsValid() const { return m_valid; }
+
+	/* Samples in the worker's window, as of the last batch of commands it processed. */
+	size_t SampleCount() const { return m_sampleCount.load(std::memory_order_relaxed); }
+
+	/* CalibrationCalc::AxisVariance of the worker's window, as of the last batch of commands it processed. */
+	double AxisVariance() const { return m_axisVariance.load(std::memory_order_relaxed); }
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	struct Command
+	{
+		enum Type
+		{
+			ClearWindow,
+			SetRelative,
+			Push
+		} type = Push;
+
+		uint64_t epoch = 0;
+		Sample sample;
+		Settings settings;
+		Eigen::AffineCompact3d transform = Eigen::AffineCompact3d::Identity();
+		bool calibrated = false;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+	typedef std::vector<Command, Eigen::aligned_allocator<Command>> CommandList;
+
+	// UI thread
+	uint64_t m_epoch = 0;
+	bool m_valid = false;
+
+	std::mutex m_inboxMutex;
+	std::condition_variable m_inboxSignal;
+	CommandList m_inbox;
+	bool m_stop = false;
+
+	// Worker thread
+	CalibrationCalc m_calc;
+	CommandList m_processing;
+	uint64_t m_workerEpoch = 0;
+
+	std::atomic<size_t> m_sampleCount { 0 };
+	std::atomic<double> m_axisVariance { 0.0 };
+	TripleBuffer<Result> m_results;
+
+	std::thread m_thread;
+
+	void Enqueue(const Command& command);
+	void Run();
+	void Solve(const Settings& settings);
+};
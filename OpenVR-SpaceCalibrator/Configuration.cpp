@@ -129,6 +129,25 @@ static void ParseProfile(CalibrationContext &ctx, std::istream &stream)
 	if (obj["calibration_speed"].is<double>())
 		ctx.calibrationSpeed = (CalibrationContext::Speed)(int) obj["calibration_speed"].get<double>();
 
+	// Values the UI could not have saved fall back to the defaults.
+	if (obj["pair_selection"].is<double>())
+	{
+		const double selection = obj["pair_selection"].get<double>();
+		if (selection == CalibrationContext::RANDOM_PAIRS || selection == CalibrationContext::STRATIFIED_PAIRS)
+			ctx.pairSelection = (CalibrationContext::PairSelection)(int) selection;
+		else
+			ctx.pairSelection = CalibrationContext::ALL_PAIRS;
+	}
+
+	if (obj["pair_budget"].is<double>())
+	{
+		const double budget = obj["pair_budget"].get<double>();
+		if (budget >= CalibrationContext::MinPairBudget && budget <= CalibrationContext::MaxPairBudget)
+			ctx.pairBudget = (int) budget;
+		else
+			ctx.pairBudget = CalibrationContext::DefaultPairBudget;
+	}
+
 	if (obj["chaperone"].is<picojson::object>())
 	{
 		auto chaperone = obj["chaperone"].get<picojson::object>();
@@ -229,6 +248,10 @@ static void WriteProfile(CalibrationContext &ctx, std::ostream &out)
 	double speed = (int) ctx.calibrationSpeed;
 	profile["calibration_speed"].set<double>(speed);
 
+	double pairSelection = (int) ctx.pairSelection;
+	profile["pair_selection"].set<double>(pairSelection);
+	profile["pair_budget"].set<double>(ctx.pairBudget);
+
 	if (ctx.chaperone.valid)
 	{
 		picojson::object chaperone;
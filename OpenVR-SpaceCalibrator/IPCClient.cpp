@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "IPCClient.h"
 
+#include <future>
 #include <string>
 
 std::string WStringToString(const std::wstring& wstr)
@@ -23,8 +24,26 @@ static std::string LastErrorString(DWORD lastError)
 	return WStringToString(message);
 }
 
+static std::runtime_error IPCError(const std::string &what, DWORD lastError)
+{
+	return std::runtime_error(what + ". Error " + std::to_string(lastError) + ": " + LastErrorString(lastError));
+}
+
 IPCClient::~IPCClient()
 {
+	if (thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		SetEvent(wakeEvent);
+		thread.join();
+	}
+
+	if (wakeEvent)
+		CloseHandle(wakeEvent);
+
 	if (pipe && pipe != INVALID_HANDLE_VALUE)
 		CloseHandle(pipe);
 }
@@ -34,7 +53,7 @@ void IPCClient::Connect()
 	LPTSTR pipeName = TEXT(OPENVR_SPACECALIBRATOR_PIPE_NAME);
 
 	WaitNamedPipe(pipeName, 1000);
-	pipe = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
+	pipe = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, 0);
 
 	if (pipe == INVALID_HANDLE_VALUE)
 	{
@@ -44,10 +63,17 @@ void IPCClient::Connect()
 	DWORD mode = PIPE_READMODE_MESSAGE;
 	if (!SetNamedPipeHandleState(pipe, &mode, 0, 0))
 	{
-		DWORD lastError = GetLastError();
-		throw std::runtime_error("Couldn't set pipe mode. Error " + std::to_string(lastError) + ": " + LastErrorString(lastError));
+		throw IPCError("Couldn't set pipe mode", GetLastError());
+	}
+
+	wakeEvent = CreateEvent(0, FALSE, FALSE, 0);
+	if (!wakeEvent)
+	{
+		throw IPCError("Couldn't create IPC event", GetLastError());
 	}
 
+	thread = std::thread(&IPCClient::Run, this);
+
 	auto response = SendBlocking(protocol::Request(protocol::RequestHandshake));
 	if (response.type != protocol::ResponseHandshake || response.protocol.version != protocol::Version)
 	{
@@ -63,40 +89,185 @@ void IPCClient::Connect()
 
 protocol::Response IPCClient::SendBlocking(const protocol::Request &request)
 {
-	Send(request);
-	return Receive();
+	std::promise<protocol::Response> promise;
+	auto future = promise.get_future();
+
+	SendAsync(request, [&promise](const protocol::Response &response) { promise.set_value(response); });
+
+	protocol::Response response = future.get();
+	if (response.type == protocol::ResponseInvalid)
+		RethrowError();
+
+	return response;
 }
 
-void IPCClient::Send(const protocol::Request &request)
+void IPCClient::SendAsync(const protocol::Request &request, ResponseHandler onResponse)
 {
-	DWORD bytesWritten;
-	BOOL success = WriteFile(pipe, &request, sizeof request, &bytesWritten, 0);
-	if (!success)
+	bool queued = false;
 	{
-		DWORD lastError = GetLastError();
-		throw std::runtime_error("Error writing IPC request. Error " + std::to_string(lastError) + ": " + LastErrorString(lastError));
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!error && thread.joinable())
+		{
+			queue.push_back(Outgoing { request, std::move(onResponse) });
+			queue.back().request.requestId = nextRequestId++;
+			queued = true;
+		}
 	}
+
+	if (queued)
+		SetEvent(wakeEvent);
+	else if (onResponse)
+		onResponse(protocol::Response(protocol::ResponseInvalid));
+}
+
+void IPCClient::RethrowError()
+{
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		e = error;
+	}
+
+	if (e)
+		std::rethrow_exception(e);
 }
 
-protocol::Response IPCClient::Receive()
+/*
+ * IPC thread: writes queued requests one at a time while a read for the next response stays posted, so that
+ * a driver blocked on writing a response to us never keeps us from taking our next request off the queue.
+ */
+void IPCClient::Run()
 {
-	protocol::Response response(protocol::ResponseInvalid);
-	DWORD bytesRead;
+	OVERLAPPED writeOverlap = {}, readOverlap = {};
+	writeOverlap.hEvent = CreateEvent(0, TRUE, FALSE, 0);
+	readOverlap.hEvent = CreateEvent(0, TRUE, FALSE, 0);
 
-	BOOL success = ReadFile(pipe, &response, sizeof response, &bytesRead, 0);
-	if (!success)
+	std::deque<InFlight> inFlight;
+	Outgoing writing;
+	protocol::Response response;
+	bool writePending = false, readPending = false;
+
+	try
 	{
-		DWORD lastError = GetLastError();
-		if (lastError != ERROR_MORE_DATA)
+		if (!writeOverlap.hEvent || !readOverlap.hEvent)
+			throw IPCError("Couldn't create IPC event", GetLastError());
+
+		for (;;)
 		{
-			throw std::runtime_error("Error reading IPC response. Error " + std::to_string(lastError) + ": " + LastErrorString(lastError));
+			bool startWrite = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (stop)
+					break;
+
+				if (!writePending && !queue.empty())
+				{
+					writing = std::move(queue.front());
+					queue.pop_front();
+					startWrite = true;
+				}
+			}
+
+			if (startWrite)
+			{
+				inFlight.push_back(InFlight { writing.request.requestId, std::move(writing.onResponse) });
+
+				const DWORD size = (DWORD)protocol::RequestSize(writing.request);
+				if (!WriteFile(pipe, &writing.request, size, 0, &writeOverlap) && GetLastError() != ERROR_IO_PENDING)
+					throw IPCError("Error writing IPC request", GetLastError());
+				writePending = true;
+			}
+
+			if (!readPending)
+			{
+				if (!ReadFile(pipe, &response, sizeof response, 0, &readOverlap) && GetLastError() != ERROR_IO_PENDING)
+					throw IPCError("Error reading IPC response", GetLastError());
+				readPending = true;
+			}
+
+			HANDLE handles[3];
+			DWORD handleCount = 0;
+			handles[handleCount++] = wakeEvent;
+			handles[handleCount++] = readOverlap.hEvent;
+			if (writePending)
+				handles[handleCount++] = writeOverlap.hEvent;
+
+			if (WaitForMultipleObjects(handleCount, handles, FALSE, INFINITE) == WAIT_FAILED)
+				throw IPCError("Error waiting for IPC", GetLastError());
+
+			DWORD bytes;
+			if (writePending && HasOverlappedIoCompleted(&writeOverlap))
+			{
+				writePending = false;
+				if (!GetOverlappedResult(pipe, &writeOverlap, &bytes, FALSE))
+					throw IPCError("Error writing IPC request", GetLastError());
+			}
+
+			if (HasOverlappedIoCompleted(&readOverlap))
+			{
+				readPending = false;
+				if (!GetOverlappedResult(pipe, &readOverlap, &bytes, FALSE))
+				{
+					DWORD lastError = GetLastError();
+					if (lastError != ERROR_MORE_DATA)
+						throw IPCError("Error reading IPC response", lastError);
+				}
+
+				if (bytes != sizeof response)
+					throw std::runtime_error("Invalid IPC response. Error SIZE_MISMATCH, got size " + std::to_string(bytes));
+
+				// The driver answers the requests on a pipe in the order they were sent.
+				if (inFlight.empty() || inFlight.front().requestId != response.requestId)
+					throw std::runtime_error("Invalid IPC response. Error ID_MISMATCH, got id " + std::to_string(response.requestId));
+
+				ResponseHandler onResponse = std::move(inFlight.front().onResponse);
+				inFlight.pop_front();
+				if (onResponse)
+					onResponse(response);
+			}
 		}
 	}
+	catch (const std::runtime_error &)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		error = std::current_exception();
+	}
 
-	if (bytesRead != sizeof response)
+	// The buffers of pending operations live on this stack, so wait for them to be cancelled before leaving.
+	if (writePending || readPending)
 	{
-		throw std::runtime_error("Invalid IPC response. Error SIZE_MISMATCH, got size " + std::to_string(bytesRead));
+		CancelIo(pipe);
+
+		DWORD bytes;
+		if (writePending)
+			GetOverlappedResult(pipe, &writeOverlap, &bytes, TRUE);
+		if (readPending)
+			GetOverlappedResult(pipe, &readOverlap, &bytes, TRUE);
 	}
 
-	return response;
+	if (writeOverlap.hEvent)
+		CloseHandle(writeOverlap.hEvent);
+	if (readOverlap.hEvent)
+		CloseHandle(readOverlap.hEvent);
+
+	Fail(inFlight);
+}
+
+/* Completes every request that will not get a response any more with ResponseInvalid. */
+void IPCClient::Fail(std::deque<InFlight> &inFlight)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &outgoing : queue)
+			inFlight.push_back(InFlight { outgoing.request.requestId, std::move(outgoing.onResponse) });
+		queue.clear();
+	}
+
+	const protocol::Response invalid(protocol::ResponseInvalid);
+	for (auto &request : inFlight)
+	{
+		if (request.onResponse)
+			request.onResponse(invalid);
+	}
+	inFlight.clear();
 }
@@ -2,17 +2,61 @@
 
 #include "../Protocol.h"
 
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * Connection to the driver's named pipe. Requests are queued and written by a dedicated IPC thread, which
+ * keeps a read posted at the same time, so several requests can be in flight and the caller never waits for
+ * the driver unless it asks to. Responses carry the id of their request and come back in request order.
+ */
 class IPCClient
 {
 public:
+	typedef std::function<void(const protocol::Response &)> ResponseHandler;
+
 	~IPCClient();
 
 	void Connect();
+
+	/* Sends a request and waits for its response. Throws if the connection failed. */
 	protocol::Response SendBlocking(const protocol::Request &request);
 
-	void Send(const protocol::Request &request);
-	protocol::Response Receive();
+	/*
+	 * Queues a request and returns at once. onResponse, if set, is called on the IPC thread with the response,
+	 * or with a ResponseInvalid response if the connection failed first. Failures are reported by RethrowError.
+	 */
+	void SendAsync(const protocol::Request &request, ResponseHandler onResponse = nullptr);
+
+	/* Throws the error that broke the connection, if any. */
+	void RethrowError();
 
 private:
+	struct Outgoing
+	{
+		protocol::Request request;
+		ResponseHandler onResponse;
+	};
+
+	struct InFlight
+	{
+		uint32_t requestId;
+		ResponseHandler onResponse;
+	};
+
 	HANDLE pipe = INVALID_HANDLE_VALUE;
-};
\ No newline at end of file
+	HANDLE wakeEvent = NULL;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::deque<Outgoing> queue;
+	std::exception_ptr error;
+	bool stop = false;
+	uint32_t nextRequestId = 1;
+
+	void Run();
+	void Fail(std::deque<InFlight> &inFlight);
+};
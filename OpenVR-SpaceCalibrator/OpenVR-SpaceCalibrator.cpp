@@ -14,6 +14,7 @@
 #include <openvr.h>
 #include <direct.h>
 #include <chrono>
+#include <memory>
 #include <thread>
 
 
@@ -374,6 +375,12 @@ void RunLoop()
 		if (dashboardVisible && waitEventsTimeout > dashboardInterval)
 			waitEventsTimeout = dashboardInterval;
 
+		// While calibrating, ticks only have work to do once the driver has new poses, so sleep until it does.
+		const double poseWakeupTimeout = 0.25;
+		if (!dashboardVisible && !immediateRedraw && CalCtx.wantedUpdateInterval == 0.0
+			&& ArmPoseWakeup(glfwGetTime(), glfwPostEmptyEvent))
+			waitEventsTimeout = poseWakeupTimeout;
+
 		if (immediateRedraw) {
 			waitEventsTimeout = 0;
 			immediateRedraw = false;
@@ -448,6 +455,51 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 	return 0;
 }
 
+/*
+ * Prints the pose hook statistics the running driver has collected: for each device, its current rate of hook
+ * calls, measured over one second, and percentiles of what the hook and HandleDevicePoseUpdated took.
+ */
+static int PrintDriverStats()
+{
+	protocol::DriverStatsShmem stats;
+	try
+	{
+		stats.Open(OPENVR_SPACECALIBRATOR_STATS_SHMEM_NAME);
+	}
+	catch (std::runtime_error &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return -2;
+	}
+
+	uint64_t callsBefore[vr::k_unMaxTrackedDeviceCount];
+	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; id++)
+		callsBefore[id] = stats.Calls(id);
+
+	const double interval = 1.0;
+	std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+
+	std::unique_ptr<protocol::DriverStatsShmem::DeviceStats> device(new protocol::DriverStatsShmem::DeviceStats);
+	printf("%-6s %8s %12s %12s %12s %12s %12s %12s %12s\n", "device", "Hz", "calls",
+		"hook p50", "p99", "p99.9", "handle p50", "p99", "p99.9");
+
+	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; id++)
+	{
+		stats.Read(id, *device);
+		const uint64_t calls = device->Calls();
+		if (calls == 0)
+			continue;
+
+		printf("%-6u %8.0f %12llu %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n", id,
+			(calls - callsBefore[id]) / interval, (unsigned long long)calls,
+			device->hook.Percentile(0.5) / 1000.0, device->hook.Percentile(0.99) / 1000.0, device->hook.Percentile(0.999) / 1000.0,
+			device->handle.Percentile(0.5) / 1000.0, device->handle.Percentile(0.99) / 1000.0, device->handle.Percentile(0.999) / 1000.0);
+	}
+
+	printf("Latencies in microseconds, since the driver was loaded.\n");
+	return 0;
+}
+
 static void HandleCommandLine(LPWSTR lpCmdLine)
 {
 	if (lstrcmp(lpCmdLine, L"-openvrpath") == 0)
@@ -530,6 +582,10 @@ static void HandleCommandLine(LPWSTR lpCmdLine)
 		vr::VR_Shutdown();
 		exit(-2);
 	}
+	else if (lstrcmp(lpCmdLine, L"-driverstats") == 0)
+	{
+		exit(PrintDriverStats());
+	}
 	else if (lstrcmp(lpCmdLine, L"-activatemultipledrivers") == 0)
 	{
 		int ret = -2;
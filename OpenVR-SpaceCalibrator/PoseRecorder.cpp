@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "PoseRecorder.h"
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+PoseRecorder Recorder;
+
+PoseRecorder::~PoseRecorder() {
+	Stop();
+}
+
+void PoseRecorder::Start(const std::wstring &path) {
+	Stop();
+
+	m_shmem.Open(OPENVR_SPACECALIBRATOR_SHMEM_NAME);
+	m_shmem.SkipToLatest();
+
+	if (_wfopen_s(&m_file, path.c_str(), L"wb") != 0) {
+		m_file = nullptr;
+		m_shmem.Close();
+		throw std::runtime_error("Failed to create pose recording file");
+	}
+	// Chunks are written whole; there is nothing for stdio to batch.
+	setvbuf(m_file, nullptr, _IONBF, 0);
+
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	recording::FileHeader header = {};
+	memcpy(header.magic, recording::FileMagic, sizeof header.magic);
+	header.formatVersion = recording::FormatVersion;
+	header.compactPoseVersion = protocol::CompactPoseVersion;
+	header.timestampFrequency = freq.QuadPart;
+	header.startUnixTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	header.startSampleTime = now.QuadPart;
+
+	m_fileOffset = 0;
+	m_index.clear();
+	m_recordedPoses = m_skippedPoses = m_droppedPoses = m_bytesWritten = 0;
+	m_writeFailed = false;
+	WriteBytes(&header, sizeof header);
+
+	if (m_chunks.empty()) {
+		for (uint32_t i = 0; i < ChunkCount; i++) {
+			m_chunks.emplace_back(new Chunk);
+		}
+	}
+	m_freeChunks.clear();
+	for (auto &chunk : m_chunks) {
+		m_freeChunks.push_back(chunk.get());
+	}
+	m_writeQueue.clear();
+	m_readerDone = false;
+	m_stop = false;
+
+	m_writer = std::thread(&PoseRecorder::Write, this);
+	m_reader = std::thread(&PoseRecorder::Read, this);
+}
+
+void PoseRecorder::Stop() {
+	if (!m_reader.joinable()) return;
+
+	m_stop = true;
+	m_reader.join();
+	m_writer.join();
+
+	recording::Trailer trailer = {};
+	trailer.indexOffset = m_fileOffset;
+	trailer.chunkCount = (uint32_t)m_index.size();
+	trailer.magic = recording::TrailerMagic;
+
+	if (!m_index.empty()) {
+		WriteBytes(&m_index[0], m_index.size() * sizeof m_index[0]);
+	}
+	WriteBytes(&trailer, sizeof trailer);
+
+	fclose(m_file);
+	m_file = nullptr;
+	m_shmem.Close();
+}
+
+PoseRecorder::Stats PoseRecorder::GetStats() const {
+	Stats stats;
+	stats.recordedPoses = m_recordedPoses.load(std::memory_order_relaxed);
+	stats.skippedPoses = m_skippedPoses.load(std::memory_order_relaxed);
+	stats.droppedPoses = m_droppedPoses.load(std::memory_order_relaxed);
+	stats.bytesWritten = m_bytesWritten.load(std::memory_order_relaxed);
+	stats.writeFailed = m_writeFailed.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void PoseRecorder::Read() {
+	// Where poses go while no chunk buffer is free.
+	std::unique_ptr<protocol::CompactPose[]> discard(new protocol::CompactPose[ChunkPoses]);
+
+	Chunk *chunk = nullptr;
+	uint32_t count = 0;
+	auto opened = std::chrono::steady_clock::now();
+	uint64_t lostPoses = 0, skippedSoFar = 0;
+
+	auto submit = [&] {
+		chunk->header.magic = recording::ChunkMagic;
+		chunk->header.poseCount = count;
+		chunk->header.firstSampleTime = chunk->poses[0].sampleTime;
+		chunk->header.lastSampleTime = chunk->poses[count - 1].sampleTime;
+		chunk->header.droppedPoses = lostPoses;
+		lostPoses = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_writeQueue.push_back(chunk);
+		}
+		m_writeSignal.notify_one();
+		m_recordedPoses.fetch_add(count, std::memory_order_relaxed);
+		chunk = nullptr;
+	};
+
+	for (;;) {
+		// Checked before draining, so that the poses written up to the moment Stop was called still make it in.
+		const bool stopping = m_stop.load();
+
+		// A short read means the ring is drained, or stopped at a pose still being written; either way, the next read
+		// waits. Reading again at once would give up on that pose before its writer had a chance to finish it.
+		size_t read, requested;
+		do {
+			if (!chunk) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_freeChunks.empty()) {
+					chunk = m_freeChunks.back();
+					m_freeChunks.pop_back();
+					count = 0;
+					opened = std::chrono::steady_clock::now();
+				}
+			}
+
+			if (chunk) {
+				requested = ChunkPoses - count;
+				read = m_shmem.ReadNewPoses(chunk->poses + count, requested);
+				count += (uint32_t)read;
+			}
+			else {
+				requested = ChunkPoses;
+				read = m_shmem.ReadNewPoses(discard.get(), requested);
+				m_droppedPoses.fetch_add(read, std::memory_order_relaxed);
+				lostPoses += read;
+			}
+
+			const uint64_t skipped = m_shmem.SkippedPoses();
+			m_skippedPoses.fetch_add(skipped - skippedSoFar, std::memory_order_relaxed);
+			lostPoses += skipped - skippedSoFar;
+			skippedSoFar = skipped;
+
+			if (chunk && count == ChunkPoses) submit();
+		} while (read == requested);
+
+		const bool due = std::chrono::steady_clock::now() - opened >= std::chrono::milliseconds(FlushIntervalMs);
+		if (chunk && count > 0 && (due || stopping)) submit();
+		if (stopping) break;
+
+		if (m_shmem.NotificationsAvailable())
+			m_shmem.WaitForNewPoses(m_shmem.PoseEntry(), 20);
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (chunk) m_freeChunks.push_back(chunk);
+	m_readerDone = true;
+	m_writeSignal.notify_one();
+}
+
+void PoseRecorder::Write() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_writeSignal.wait(lock, [this] { return m_readerDone || !m_writeQueue.empty(); });
+		if (m_writeQueue.empty()) return;
+
+		Chunk *chunk = m_writeQueue.front();
+		m_writeQueue.pop_front();
+
+		lock.unlock();
+		WriteChunk(*chunk);
+		lock.lock();
+
+		m_freeChunks.push_back(chunk);
+	}
+}
+
+void PoseRecorder::WriteChunk(const Chunk &chunk) {
+	static_assert(offsetof(Chunk, poses) == sizeof(recording::ChunkHeader), "A chunk is written with one write, header first");
+
+	recording::IndexEntry entry = {};
+	entry.offset = m_fileOffset;
+	entry.firstSampleTime = chunk.header.firstSampleTime;
+	entry.lastSampleTime = chunk.header.lastSampleTime;
+	entry.poseCount = chunk.header.poseCount;
+
+	if (WriteBytes(&chunk.header, sizeof chunk.header + chunk.header.poseCount * sizeof chunk.poses[0])) {
+		m_index.push_back(entry);
+	}
+}
+
+bool PoseRecorder::WriteBytes(const void *data, size_t size) {
+	if (m_writeFailed.load(std::memory_order_relaxed)) return false;
+
+	if (fwrite(data, 1, size, m_file) != size) {
+		m_writeFailed = true;
+		return false;
+	}
+
+	m_fileOffset += size;
+	m_bytesWritten.fetch_add(size, std::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <openvr.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../PoseRecording.h"
+
+/*
+ * Records every pose the driver publishes into a pose recording (see PoseRecording.h).
+ *
+ * A reader thread drains the driver's pose ring through a DriverPoseShmem of its own, straight into chunk buffers
+ * from a fixed pool. Chunks that are full, or have been open for FlushInterval, go to a writer thread, which
+ * writes each with a single sequential write and returns the buffer to the pool. The pool holds about a second
+ * of poses from 64 devices at 2 kHz, so a briefly stalled disk costs nothing; if it does run dry, the reader
+ * keeps draining the ring, so as not to fall behind the driver, but discards what it reads. Every pose lost
+ * either way is counted, both in the recording and in GetStats.
+ */
+class PoseRecorder
+{
+public:
+	struct Stats
+	{
+		uint64_t recordedPoses = 0;
+		uint64_t skippedPoses = 0; // lost in the ring: overwritten before the reader got to them
+		uint64_t droppedPoses = 0; // read from the ring, but discarded for lack of a free chunk buffer
+		uint64_t bytesWritten = 0;
+		bool writeFailed = false;
+	};
+
+	PoseRecorder() { }
+	~PoseRecorder();
+
+	PoseRecorder(const PoseRecorder&) = delete;
+	PoseRecorder& operator=(const PoseRecorder&) = delete;
+
+	/* Starts recording into a new file at path. Throws if the file or the driver's pose ring cannot be opened. */
+	void Start(const std::wstring &path);
+
+	/* Writes out what was read so far, finishes the file with its index, and closes it. */
+	void Stop();
+
+	bool IsRecording() const { return m_reader.joinable(); }
+	Stats GetStats() const;
+
+private:
+	static const uint32_t ChunkPoses = 16 * 1024;
+	static const uint32_t ChunkCount = 8;
+	static const uint32_t FlushIntervalMs = 250;
+
+	struct Chunk
+	{
+		recording::ChunkHeader header;
+		protocol::CompactPose poses[ChunkPoses];
+	};
+
+	protocol::DriverPoseShmem m_shmem;
+	FILE *m_file = nullptr;
+	uint64_t m_fileOffset = 0;
+	std::vector<recording::IndexEntry> m_index;
+
+	std::vector<std::unique_ptr<Chunk>> m_chunks;
+
+	std::mutex m_mutex;
+	std::condition_variable m_writeSignal;
+	std::vector<Chunk*> m_freeChunks;
+	std::deque<Chunk*> m_writeQueue;
+	bool m_readerDone = false;
+
+	std::atomic<bool> m_stop { false };
+	std::atomic<uint64_t> m_recordedPoses { 0 }, m_skippedPoses { 0 }, m_droppedPoses { 0 }, m_bytesWritten { 0 };
+	std::atomic<bool> m_writeFailed { false };
+
+	std::thread m_reader, m_writer;
+
+	void Read();
+	void Write();
+	void WriteChunk(const Chunk &chunk);
+	bool WriteBytes(const void *data, size_t size);
+};
+
+extern PoseRecorder Recorder;
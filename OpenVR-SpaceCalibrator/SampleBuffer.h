@@ -0,0 +1,169 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Fixed-capacity ring of calibration samples, stored as one column per scalar (structure of arrays).
+ *
+ * Every sample is written twice, at its slot and again at slot + capacity, so the window always occupies
+ * the contiguous range [head, head + size) of each column. Passes over the window can therefore stream
+ * each column linearly (or map it as an Eigen array) without ever handling the wrap-around.
+ */
+class SampleBuffer
+{
+public:
+	enum Column
+	{
+		RefRotW, RefRotX, RefRotY, RefRotZ,
+		RefPosX, RefPosY, RefPosZ,
+		TargetRotW, TargetRotX, TargetRotY, TargetRotZ,
+		TargetPosX, TargetPosY, TargetPosZ,
+		ColumnCount
+	};
+
+	typedef Eigen::Map<const Eigen::ArrayXd> ColumnMap;
+	typedef Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::OuterStride<>> BlockMap;
+
+	static const size_t CacheLineDoubles = 64 / sizeof(double);
+
+	SampleBuffer() { }
+	SampleBuffer(const SampleBuffer&) = delete;
+	SampleBuffer& operator=(const SampleBuffer&) = delete;
+	SampleBuffer(SampleBuffer&&) = default;
+	SampleBuffer& operator=(SampleBuffer&&) = default;
+
+	/* Discards all samples and reallocates the columns to hold `capacity` samples. */
+	void Reset(size_t capacity) {
+		m_capacity = capacity;
+		m_stride = (2 * capacity + CacheLineDoubles - 1) / CacheLineDoubles * CacheLineDoubles;
+
+		m_storage.assign(ColumnCount * m_stride + CacheLineDoubles, 0.0);
+		void* base = m_storage.data();
+		size_t space = m_storage.size() * sizeof(double);
+		m_base = static_cast<double*>(std::align(64, ColumnCount * m_stride * sizeof(double), base, space));
+
+		m_valid.assign((2 * capacity + 63) / 64, 0);
+		Clear();
+	}
+
+	void Clear() {
+		m_head = 0;
+		m_size = 0;
+		m_validCount = 0;
+		std::fill(m_valid.begin(), m_valid.end(), 0);
+	}
+
+	size_t Capacity() const { return m_capacity; }
+	size_t Size() const { return m_size; }
+	bool Empty() const { return m_size == 0; }
+	bool Full() const { return m_size == m_capacity; }
+	size_t ValidCount() const { return m_validCount; }
+
+	/* Ring slot of the index-th oldest sample, for callers keeping per-sample data alongside the buffer. */
+	size_t Slot(size_t index) const {
+		return (m_head + index) % m_capacity;
+	}
+
+	/* The caller is responsible for making room (PopFront) once the buffer is full. */
+	void Push(
+		const Eigen::Quaterniond& refRot, const Eigen::Vector3d& refPos,
+		const Eigen::Quaterniond& targetRot, const Eigen::Vector3d& targetPos,
+		bool valid
+	) {
+		const size_t slot = Slot(m_size);
+		const double values[ColumnCount] = {
+			refRot.w(), refRot.x(), refRot.y(), refRot.z(),
+			refPos.x(), refPos.y(), refPos.z(),
+			targetRot.w(), targetRot.x(), targetRot.y(), targetRot.z(),
+			targetPos.x(), targetPos.y(), targetPos.z(),
+		};
+
+		for (int c = 0; c < ColumnCount; c++) {
+			m_base[c * m_stride + slot] = values[c];
+			m_base[c * m_stride + slot + m_capacity] = values[c];
+		}
+
+		SetValid(slot, valid);
+		SetValid(slot + m_capacity, valid);
+		if (valid) m_validCount++;
+		m_size++;
+	}
+
+	void PopFront() {
+		if (m_size == 0) return;
+
+		if (IsValid(0)) m_validCount--;
+		m_head = (m_head + 1) % m_capacity;
+		m_size--;
+	}
+
+	/* Column values of the whole window, oldest sample first. */
+	const double* Data(Column column) const {
+		return m_base + column * m_stride + m_head;
+	}
+
+	ColumnMap Map(Column column) const {
+		return ColumnMap(Data(column), (Eigen::Index)m_size);
+	}
+
+	/* The window as a (size x count) matrix of consecutive columns starting at `first`. */
+	BlockMap Block(Column first, int count) const {
+		return BlockMap(Data(first), (Eigen::Index)m_size, count, Eigen::OuterStride<>((Eigen::Index)m_stride));
+	}
+
+	bool IsValid(size_t index) const {
+		const size_t bit = m_head + index;
+		return (m_valid[bit / 64] >> (bit % 64)) & 1;
+	}
+
+	/* 1.0 for valid samples and 0.0 for the others, for use as weights in array expressions. */
+	Eigen::ArrayXd ValidMask() const {
+		if (m_validCount == m_size) return Eigen::ArrayXd::Ones((Eigen::Index)m_size);
+
+		Eigen::ArrayXd mask((Eigen::Index)m_size);
+		for (size_t i = 0; i < m_size; i++) {
+			mask((Eigen::Index)i) = IsValid(i) ? 1.0 : 0.0;
+		}
+		return mask;
+	}
+
+	Eigen::Quaterniond RefRotation(size_t index) const { return Rotation(RefRotW, index); }
+	Eigen::Vector3d RefPosition(size_t index) const { return Position(RefPosX, index); }
+	Eigen::Quaterniond TargetRotation(size_t index) const { return Rotation(TargetRotW, index); }
+	Eigen::Vector3d TargetPosition(size_t index) const { return Position(TargetPosX, index); }
+
+private:
+	std::vector<double> m_storage;
+	double* m_base = nullptr;
+	size_t m_stride = 0;
+
+	std::vector<uint64_t> m_valid;
+
+	size_t m_capacity = 0;
+	size_t m_head = 0;
+	size_t m_size = 0;
+	size_t m_validCount = 0;
+
+	void SetValid(size_t bit, bool valid) {
+		const uint64_t mask = 1ULL << (bit % 64);
+		if (valid) m_valid[bit / 64] |= mask;
+		else m_valid[bit / 64] &= ~mask;
+	}
+
+	double At(int column, size_t index) const {
+		return m_base[column * m_stride + m_head + index];
+	}
+
+	Eigen::Quaterniond Rotation(int w, size_t index) const {
+		return Eigen::Quaterniond(At(w, index), At(w + 1, index), At(w + 2, index), At(w + 3, index));
+	}
+
+	Eigen::Vector3d Position(int x, size_t index) const {
+		return Eigen::Vector3d(At(x, index), At(x + 1, index), At(x + 2, index));
+	}
+};
@@ -4,6 +4,7 @@
 #include "Configuration.h"
 #include "VRState.h"
 #include "CalibrationMetrics.h"
+#include "PoseRecorder.h"
 #include "../Version.h"
 
 #include <thread>
@@ -359,6 +360,32 @@ void DrawVectorElement(std::string id, const char *text, double *value)
 	}
 }
 
+static void TogglePoseRecording(bool start)
+{
+	if (!start)
+	{
+		Recorder.Stop();
+		return;
+	}
+
+	// Recordings are kept until the user deletes them, since they are made to reproduce problems later.
+	std::wstring path = Metrics::NewLogFilePath(L"spacecal_poses", L".bin", true);
+	if (path.empty())
+	{
+		CalCtx.Log("Failed to create pose recording file\n");
+		return;
+	}
+
+	try
+	{
+		Recorder.Start(path);
+	}
+	catch (std::runtime_error &e)
+	{
+		CalCtx.Log(std::string("Failed to start pose recording: ") + e.what() + "\n");
+	}
+}
+
 void CCal_BasicInfo()
 {
 	if (ImGui::BeginTable("DeviceInfo", 2, 0))
@@ -453,10 +480,27 @@ void CCal_BasicInfo()
 	ImGui::SameLine();
 	ImGui::Checkbox(u8"输出日志", &Metrics::enableLogs);
 	ImGui::SameLine();
+	bool recording = Recorder.IsRecording();
+	if (ImGui::Checkbox(u8"录制姿态", &recording))
+	{
+		TogglePoseRecording(recording);
+	}
+	ImGui::SameLine();
 	ImGui::Checkbox(u8"锁定相对位置", &CalCtx.lockRelativePosition);
 	ImGui::SameLine();
 	ImGui::Checkbox(u8"按住左右扳机继续校准", &CalCtx.requireTriggerPressToApply);
 
+	if (Recorder.IsRecording())
+	{
+		auto stats = Recorder.GetStats();
+		ImGui::Text(u8"姿态录制：已录制 %llu，环形缓冲区溢出丢失 %llu，写入不及丢弃 %llu，%.1f MB%s",
+			(unsigned long long)stats.recordedPoses,
+			(unsigned long long)stats.skippedPoses,
+			(unsigned long long)stats.droppedPoses,
+			stats.bytesWritten / (1024.0 * 1024.0),
+			stats.writeFailed ? u8"（写入失败）" : "");
+	}
+
 	// Status field...
 
 	ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0, 0, 0, 1));
@@ -571,6 +615,30 @@ void BuildMenu(bool runningInOverlay)
 			CalCtx.calibrationSpeed = CalibrationContext::VERY_SLOW;
 
 		ImGui::Columns(1);
+
+		auto pairSelection = CalCtx.pairSelection;
+
+		ImGui::Columns(4, NULL, false);
+		ImGui::Text(u8"样本配对");
+
+		ImGui::NextColumn();
+		if (ImGui::RadioButton(u8" 全部         ", pairSelection == CalibrationContext::ALL_PAIRS))
+			CalCtx.pairSelection = CalibrationContext::ALL_PAIRS;
+
+		ImGui::NextColumn();
+		if (ImGui::RadioButton(u8" 随机         ", pairSelection == CalibrationContext::RANDOM_PAIRS))
+			CalCtx.pairSelection = CalibrationContext::RANDOM_PAIRS;
+
+		ImGui::NextColumn();
+		if (ImGui::RadioButton(u8" 分层     ", pairSelection == CalibrationContext::STRATIFIED_PAIRS))
+			CalCtx.pairSelection = CalibrationContext::STRATIFIED_PAIRS;
+
+		ImGui::Columns(1);
+
+		if (CalCtx.pairSelection != CalibrationContext::ALL_PAIRS)
+		{
+			ImGui::SliderInt(u8"每个样本的配对数", &CalCtx.pairBudget, CalibrationContext::MinPairBudget, CalibrationContext::MaxPairBudget);
+		}
 	}
 	else if (CalCtx.state == CalibrationState::Editing)
 	{
@@ -605,6 +673,14 @@ void BuildMenu(bool runningInOverlay)
 				ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), "");
 				ImGui::SetCursorPosY(ImGui::GetCursorPosY() - ImGui::GetFontSize() - style.FramePadding.y * 2);
 				ImGui::Text(" %d%%", (int)(fraction * 100));
+
+				if (message.rotationCoverage >= 0.0f)
+				{
+					ImGui::Text(u8"旋转覆盖度");
+					ImGui::ProgressBar(message.rotationCoverage, ImVec2(-1.0f, 0.0f), "");
+					if (message.rotationCoverage < 1.0f)
+						ImGui::TextWrapped(u8"请绕多个不同的轴转动设备");
+				}
 				break;
 			}
 		}
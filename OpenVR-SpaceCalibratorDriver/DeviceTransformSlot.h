@@ -0,0 +1,91 @@
+#pragma once
+
+#include "IsometryTransform.h"
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * The transform the calibrator wants a device to have, as set over IPC or the transform table.
+ */
+struct DeviceTarget
+{
+	bool enabled = false;
+	bool quash = false;
+	IsoTransform transform;
+	double scale = 1.0;
+
+	/**
+	 * Bumped whenever the translation or rotation is set without lerping, which tells the pose hook to jump to
+	 * the new value instead of blending towards it.
+	 */
+	uint32_t translationSnaps = 0;
+	uint32_t rotationSnaps = 0;
+};
+
+/**
+ * Hands a value, such as a device's DeviceTarget, from the threads that set it to the pose hook, without ever
+ * making the hook wait.
+ *
+ * The slot holds two buffers, each under its own sequence counter (odd while being written). Publish fills the
+ * buffer that is not current and then makes it current, so a reader is normally copying a buffer nobody writes
+ * to. Only if two values are published while one copy is in progress does the writer come back around to the
+ * buffer being read; the reader notices from the counter, and Read fails rather than returning a mix of the two.
+ * The pose hook then keeps the value it had, and picks up the new one on the next pose.
+ *
+ * Publish must not be called concurrently with itself. Read may be called from any number of threads.
+ */
+template<typename T>
+class SeqlockSlot
+{
+public:
+	void Publish(const T& value) {
+		const uint32_t current = published.load(std::memory_order_relaxed);
+		Buffer& buffer = buffers[(current + 1) & 1];
+
+		const uint32_t sequence = buffer.sequence.load(std::memory_order_relaxed);
+		buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		buffer.value = value;
+
+		buffer.sequence.store(sequence + 2, std::memory_order_release);
+		published.store(current + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Copies the current value if it was published after `seen`, and advances `seen`. Returns false if there is
+	 * nothing new, or if the copy raced with two publishes; `value` is left alone in both cases.
+	 */
+	bool Read(T& value, uint32_t& seen) const {
+		const uint32_t current = published.load(std::memory_order_acquire);
+		if (current == seen) return false;
+
+		const Buffer& buffer = buffers[current & 1];
+		const uint32_t sequence = buffer.sequence.load(std::memory_order_acquire);
+		if (sequence & 1) return false;
+
+		T copy = buffer.value;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer.sequence.load(std::memory_order_relaxed) != sequence) return false;
+
+		value = copy;
+		seen = current;
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	struct Buffer
+	{
+		std::atomic<uint32_t> sequence { 0 };
+		T value;
+	};
+
+	// Number of publishes so far; buffers[published & 1] holds the latest.
+	std::atomic<uint32_t> published { 0 };
+	Buffer buffers[2];
+};
+
+typedef SeqlockSlot<DeviceTarget> DeviceTransformSlot;
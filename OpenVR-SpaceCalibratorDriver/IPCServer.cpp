@@ -2,8 +2,18 @@
 #include "Logging.h"
 #include "ServerTrackedDeviceProvider.h"
 
-void IPCServer::HandleRequest(const protocol::Request &request, protocol::Response &response)
+void IPCServer::HandleRequest(const protocol::Request &request, DWORD size, protocol::Response &response)
 {
+	response.requestId = size >= offsetof(protocol::Request, setDeviceTransform) ? request.requestId : 0;
+
+	if (size < offsetof(protocol::Request, setDeviceTransform) || size < protocol::RequestSize(request)
+		|| (request.type == protocol::RequestSetDeviceTransforms && request.setDeviceTransforms.count > vr::k_unMaxTrackedDeviceCount))
+	{
+		LOG("Truncated IPC request: %d, %d bytes", request.type, size);
+		response.type = protocol::ResponseInvalid;
+		return;
+	}
+
 	switch (request.type)
 	{
 	case protocol::RequestHandshake:
@@ -26,6 +36,11 @@ void IPCServer::HandleRequest(const protocol::Request &request, protocol::Respon
 		response.type = protocol::ResponseSuccess;
 		break;
 
+	case protocol::RequestSetDeviceTransforms:
+		driver->SetDeviceTransforms(request.setDeviceTransforms);
+		response.type = protocol::ResponseSuccess;
+		break;
+
 	default:
 		LOG("Invalid IPC request: %d", request.type);
 		break;
@@ -182,7 +197,7 @@ void IPCServer::CompletedReadCallback(DWORD err, DWORD bytesRead, LPOVERLAPPED o
 
 	if (err == 0 && bytesRead > 0)
 	{
-		pipeInst->server->HandleRequest(pipeInst->request, pipeInst->response);
+		pipeInst->server->HandleRequest(pipeInst->request, bytesRead, pipeInst->response);
 		success = WriteFileEx(
 			pipeInst->pipe,
 			&pipeInst->response,
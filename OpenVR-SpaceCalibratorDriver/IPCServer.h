@@ -21,7 +21,7 @@ public:
 	void Stop();
 
 private:
-	void HandleRequest(const protocol::Request &request, protocol::Response &response);
+	void HandleRequest(const protocol::Request &request, DWORD size, protocol::Response &response);
 
 	struct PipeInstance
 	{
@@ -14,24 +14,39 @@ static Hook<void(*)(vr::IVRServerDriverHost *, uint32_t, const vr::DriverPose_t
 static Hook<void(*)(vr::IVRServerDriverHost *, uint32_t, const vr::DriverPose_t &, uint32_t)>
 	TrackedDevicePoseUpdatedHook006("IVRServerDriverHost006::TrackedDevicePoseUpdated");
 
-static void DetourTrackedDevicePoseUpdated005(vr::IVRServerDriverHost *_this, uint32_t unWhichDevice, const vr::DriverPose_t &newPose, uint32_t unPoseStructSize)
+/**
+ * Body of both TrackedDevicePoseUpdated detours: lets the driver adjust the pose, hands it on to SteamVR, and then
+ * records what that cost in the driver's statistics, so the bookkeeping itself does not delay the pose.
+ */
+template<typename HookType>
+static void ForwardDevicePose(HookType &hook, protocol::DriverStatsShmem::HookInterface hookInterface,
+	vr::IVRServerDriverHost *_this, uint32_t unWhichDevice, const vr::DriverPose_t &newPose, uint32_t unPoseStructSize)
 {
-	//TRACE("ServerTrackedDeviceProvider::DetourTrackedDevicePoseUpdated(%d)", unWhichDevice);
+	const int64_t entered = protocol::DriverStatsShmem::Timestamp();
+
 	auto pose = newPose;
-	if (Driver->HandleDevicePoseUpdated(unWhichDevice, pose))
+	const bool forward = Driver->HandleDevicePoseUpdated(unWhichDevice, pose);
+	const int64_t handled = protocol::DriverStatsShmem::Timestamp();
+
+	if (forward)
 	{
-		TrackedDevicePoseUpdatedHook005.originalFunc(_this, unWhichDevice, pose, unPoseStructSize);
+		hook.originalFunc(_this, unWhichDevice, pose, unPoseStructSize);
 	}
+	const int64_t exited = protocol::DriverStatsShmem::Timestamp();
+
+	Driver->RecordPoseHook(unWhichDevice, hookInterface, entered, handled, exited);
+}
+
+static void DetourTrackedDevicePoseUpdated005(vr::IVRServerDriverHost *_this, uint32_t unWhichDevice, const vr::DriverPose_t &newPose, uint32_t unPoseStructSize)
+{
+	//TRACE("ServerTrackedDeviceProvider::DetourTrackedDevicePoseUpdated(%d)", unWhichDevice);
+	ForwardDevicePose(TrackedDevicePoseUpdatedHook005, protocol::DriverStatsShmem::ServerDriverHost005, _this, unWhichDevice, newPose, unPoseStructSize);
 }
 
 static void DetourTrackedDevicePoseUpdated006(vr::IVRServerDriverHost *_this, uint32_t unWhichDevice, const vr::DriverPose_t &newPose, uint32_t unPoseStructSize)
 {
 	//TRACE("ServerTrackedDeviceProvider::DetourTrackedDevicePoseUpdated(%d)", unWhichDevice);
-	auto pose = newPose;
-	if (Driver->HandleDevicePoseUpdated(unWhichDevice, pose))
-	{
-		TrackedDevicePoseUpdatedHook006.originalFunc(_this, unWhichDevice, pose, unPoseStructSize);
-	}
+	ForwardDevicePose(TrackedDevicePoseUpdatedHook006, protocol::DriverStatsShmem::ServerDriverHost006, _this, unWhichDevice, newPose, unPoseStructSize);
 }
 
 static void *DetourGetGenericInterface(vr::IVRDriverContext *_this, const char *pchInterfaceVersion, vr::EVRInitError *peError)
@@ -12,14 +12,22 @@ struct IsoTransform {
 	Eigen::Vector3d translation;
 
 	IsoTransform() : rotation(Eigen::Quaterniond::Identity()), translation(Eigen::Vector3d::Zero()) {}
-	IsoTransform(const Eigen::Quaterniond &rot) : rotation(rot), translation(Eigen::Vector3d::Zero()) {}
-	IsoTransform(const Eigen::Vector3d &trans) : rotation(Eigen::Quaterniond::Identity()) {}
+	explicit IsoTransform(const Eigen::Quaterniond &rot) : rotation(rot), translation(Eigen::Vector3d::Zero()) {}
+	explicit IsoTransform(const Eigen::Vector3d &trans) : rotation(Eigen::Quaterniond::Identity()), translation(trans) {}
 	IsoTransform(const Eigen::Quaterniond& rot, const Eigen::Vector3d& trans) : rotation(rot), translation(trans) {}
 	
 	void pretranslate(const Eigen::Vector3d& t) {
 		translation += t;
 	}
 
+	/**
+	 * Closed-form inverse of a rigid transform: the conjugate rotation, and the translation rotated back and negated.
+	 */
+	IsoTransform inverse() const {
+		const Eigen::Quaterniond invRotation = rotation.conjugate();
+		return IsoTransform(invRotation, -(invRotation * translation));
+	}
+
 	/**
 	 * Interpolates between this transform and target. The position of localPoint after transformation will smoothly
 	 * lerp between (this * localPoint) and (target * localPoint), despite rotation occurring around it.
@@ -30,13 +38,13 @@ struct IsoTransform {
 inline IsoTransform operator*(const IsoTransform& a, const IsoTransform& b) {
 	// tA * rA * tB * rB = tA * (trans(rA * tB)) * rA * rB
 	auto rot = a.rotation * b.rotation;
-	Eigen::Vector3d trans = a.translation + Eigen::Isometry3d(a.rotation) * b.translation;
+	Eigen::Vector3d trans = a.translation + a.rotation * b.translation;
 
 	return IsoTransform(rot, trans);
 }
 
 inline Eigen::Vector3d operator*(const IsoTransform& a, const Eigen::Vector3d& p) {
-	return a.translation + Eigen::Isometry3d(a.rotation) * p;
+	return a.translation + a.rotation * p;
 }
 
 inline IsoTransform IsoTransform::interpolateAround(double lerp, const IsoTransform& target, const Eigen::Vector3d& localPoint) const {
@@ -44,7 +52,7 @@ inline IsoTransform IsoTransform::interpolateAround(double lerp, const IsoTransf
 	Eigen::Vector3d finalPos = initialPos * (1 - lerp) + (target * localPoint) * lerp;
 
 	auto newRotation = rotation.slerp(lerp, target.rotation);
-	Eigen::Vector3d newTranslation = finalPos - Eigen::Isometry3d(newRotation) * localPoint;
+	Eigen::Vector3d newTranslation = finalPos - newRotation * localPoint;
 
 	return IsoTransform(newRotation, newTranslation);
 }
\ No newline at end of file
@@ -1,28 +1,284 @@
 #define _CRT_SECURE_NO_DEPRECATE
 #include "Logging.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+	const char *LogFileName = "space_calibrator_driver.log";
+
+	// Once the log reaches MaxLogFileSize, it is renamed to this, replacing the previous one, and started over.
+	const char *RotatedLogFileName = "space_calibrator_driver.log.1";
+	const long MaxLogFileSize = 8 * 1024 * 1024;
+
+	// The writer writes at most LogRate messages per second, in bursts of up to LogBurst, and suppresses the rest.
+	const double LogRate = 100.0;
+	const double LogBurst = 200.0;
+
+	const auto LogWriterInterval = std::chrono::milliseconds(100);
+
+	/**
+	 * A slot of the log ring, which works like Vyukov's bounded queue. Message n goes into slot n % LogSlotCount
+	 * on lap n / LogSlotCount; on lap L the slot's sequence is 2L while it is free, 2L + 1 once the message is in
+	 * it, and 2L + 2, free for the next lap, once the writer has taken it out. A zero-filled ring is empty.
+	 */
+	struct alignas(64) LogSlot
+	{
+		std::atomic<uint64_t> sequence;
+		uint64_t tsc;
+		char text[LogMessageSize];
+	};
+
+	const uint32_t LogSlotCount = 1024;
 
-FILE *LogFile;
+	LogSlot slots[LogSlotCount];
+	std::atomic<uint64_t> enqueuePosition;
+	std::atomic<uint64_t> droppedMessages;
+
+	// The reading side, used by whichever thread holds consumerMutex.
+	std::mutex consumerMutex;
+	uint64_t dequeuePosition;
+	FILE *logFile;
+	long logFileSize;
+	double logAllowance = LogBurst;
+	uint64_t lastMessageTsc;
+	uint64_t suppressedMessages;
+	std::string batch;
+
+	// Time of day, QueryPerformanceCounter and TSC at OpenLogFile, for turning TSC stamps into times of day.
+	std::chrono::system_clock::time_point startTime;
+	LARGE_INTEGER startQpc, qpcFrequency;
+	uint64_t startTsc;
+
+	std::mutex writerMutex;
+	std::condition_variable writerSignal;
+	bool writerStop;
+	// Not a plain std::thread: if the driver is never cleaned up, destroying a running std::thread would abort.
+	std::thread *writerThread;
+
+	/** TSC ticks per second, measured against QueryPerformanceCounter since OpenLogFile; 0 until measurable. */
+	double TscPerSecond()
+	{
+		LARGE_INTEGER qpc;
+		QueryPerformanceCounter(&qpc);
+		const uint64_t tsc = __rdtsc();
+
+		const double seconds = (qpc.QuadPart - startQpc.QuadPart) / (double)qpcFrequency.QuadPart;
+		if (seconds < 0.01)
+			return 0.0;
+		return (tsc - startTsc) / seconds;
+	}
+
+	void AppendLine(uint64_t tsc, double tscPerSecond, const char *text)
+	{
+		auto time = startTime;
+		if (tscPerSecond > 0.0 && tsc > startTsc)
+			time += std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>((tsc - startTsc) / tscPerSecond));
+
+		const time_t timeOfDay = std::chrono::system_clock::to_time_t(time);
+		tm value;
+		localtime_s(&value, &timeOfDay);
+
+		char stamp[16];
+		snprintf(stamp, sizeof stamp, "[%02d:%02d:%02d] ", value.tm_hour, value.tm_min, value.tm_sec);
+		batch += stamp;
+		batch += text;
+		batch += '\n';
+	}
+
+	void AppendMessage(uint64_t tsc, double tscPerSecond, const char *text)
+	{
+		if (tscPerSecond > 0.0 && tsc > lastMessageTsc)
+			logAllowance = std::min<double>(LogBurst, logAllowance + (tsc - lastMessageTsc) / tscPerSecond * LogRate);
+		lastMessageTsc = tsc;
+
+		if (logAllowance < 1.0)
+		{
+			suppressedMessages++;
+			return;
+		}
+		logAllowance -= 1.0;
+
+		if (suppressedMessages > 0)
+		{
+			char note[64];
+			snprintf(note, sizeof note, "(%llu log messages suppressed)", (unsigned long long)suppressedMessages);
+			AppendLine(tsc, tscPerSecond, note);
+			suppressedMessages = 0;
+		}
+		AppendLine(tsc, tscPerSecond, text);
+	}
+
+	void OpenLogForAppend()
+	{
+		logFile = fopen(LogFileName, "a");
+		if (logFile == nullptr)
+		{
+			logFile = stderr;
+			logFileSize = 0;
+			return;
+		}
+
+		fseek(logFile, 0, SEEK_END);
+		logFileSize = ftell(logFile);
+	}
+
+	void RotateLogFile()
+	{
+		if (logFile == stderr || logFileSize < MaxLogFileSize)
+			return;
+
+		fclose(logFile);
+		remove(RotatedLogFileName);
+		rename(LogFileName, RotatedLogFileName);
+		OpenLogForAppend();
+	}
+
+	/** Moves every complete message out of the ring and writes them in one go. Needs consumerMutex. */
+	void DrainLog()
+	{
+		const double tscPerSecond = TscPerSecond();
+
+		for (;;)
+		{
+			LogSlot &slot = slots[dequeuePosition % LogSlotCount];
+			const uint64_t lap = dequeuePosition / LogSlotCount * 2;
+			if (slot.sequence.load(std::memory_order_acquire) != lap + 1)
+				break;
+
+			AppendMessage(slot.tsc, tscPerSecond, slot.text);
+			slot.sequence.store(lap + 2, std::memory_order_release);
+			dequeuePosition++;
+		}
+
+		const uint64_t dropped = droppedMessages.exchange(0, std::memory_order_relaxed);
+		if (dropped > 0)
+		{
+			char note[64];
+			snprintf(note, sizeof note, "(%llu log messages dropped, log buffer full)", (unsigned long long)dropped);
+			AppendLine(__rdtsc(), tscPerSecond, note);
+		}
+
+		if (batch.empty())
+			return;
+
+		fwrite(batch.data(), 1, batch.size(), logFile);
+		fflush(logFile);
+		logFileSize += (long)batch.size();
+		batch.clear();
+
+		RotateLogFile();
+	}
+}
 
 void OpenLogFile()
 {
-	LogFile = fopen("space_calibrator_driver.log", "a");
-	if (LogFile == nullptr)
+	std::lock_guard<std::mutex> lock(consumerMutex);
+
+	startTime = std::chrono::system_clock::now();
+	QueryPerformanceFrequency(&qpcFrequency);
+	QueryPerformanceCounter(&startQpc);
+	startTsc = lastMessageTsc = __rdtsc();
+
+	OpenLogForAppend();
+}
+
+void StartLogWriter()
+{
+	if (writerThread)
+		return;
+
+	writerStop = false;
+	writerThread = new std::thread([] {
+		std::unique_lock<std::mutex> lock(writerMutex);
+		while (!writerStop)
+		{
+			writerSignal.wait_for(lock, LogWriterInterval);
+
+			lock.unlock();
+			LogFlush();
+			lock.lock();
+		}
+	});
+}
+
+void StopLogWriter()
+{
+	if (!writerThread)
+		return;
+
 	{
-		LogFile = stderr;
+		std::lock_guard<std::mutex> lock(writerMutex);
+		writerStop = true;
 	}
+	writerSignal.notify_one();
+	writerThread->join();
+
+	delete writerThread;
+	writerThread = nullptr;
+
+	LogFlush();
 }
 
-tm TimeForLog()
+void LogFlush()
 {
-	auto now = std::chrono::system_clock::now();
-	auto nowTime = std::chrono::system_clock::to_time_t(now);
-	tm value;
-	auto tm = localtime_s(&value, &nowTime);
-	return value;
+	std::lock_guard<std::mutex> lock(consumerMutex);
+	if (logFile)
+		DrainLog();
 }
 
-void LogFlush()
+void LogTryFlush()
 {
-	fflush(LogFile);
-}
\ No newline at end of file
+	std::unique_lock<std::mutex> lock(consumerMutex, std::try_to_lock);
+	if (lock.owns_lock() && logFile)
+		DrainLog();
+}
+
+void LogMessage(const char *fmt, ...)
+{
+	uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+	LogSlot *slot;
+	for (;;)
+	{
+		slot = &slots[position % LogSlotCount];
+		const uint64_t free = position / LogSlotCount * 2;
+		const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+		if (sequence == free)
+		{
+			if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (sequence < free)
+		{
+			// The slot still holds the message from the previous lap: the ring is full.
+			droppedMessages.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->tsc = __rdtsc();
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(slot->text, LogMessageSize, fmt, args);
+	va_end(args);
+
+	slot->sequence.store(position / LogSlotCount * 2 + 1, std::memory_order_release);
+}
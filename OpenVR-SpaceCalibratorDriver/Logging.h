@@ -1,20 +1,34 @@
 #pragma once
 
 #include <cstdio>
-#include <ctime>
-
-extern FILE *LogFile;
 
+/**
+ * Log messages are formatted on the calling thread into a fixed ring of slots, stamped with the TSC, and written
+ * to space_calibrator_driver.log by a background writer thread, so that logging never waits for the disk and
+ * never takes a lock. It is safe to log from the pose hook.
+ *
+ * Messages logged before StartLogWriter, or after StopLogWriter, stay in the ring until the writer runs or
+ * LogFlush is called. If the ring fills up, new messages are dropped, and the writer reports how many were.
+ */
 void OpenLogFile();
-tm TimeForLog();
+void StartLogWriter();
+void StopLogWriter();
+
+/** Writes out everything logged so far, on the calling thread. */
 void LogFlush();
 
+/**
+ * As LogFlush, but gives up if another thread is writing. The file is only written with consumerMutex held, so
+ * this never waits on a lock that a thread killed mid-write left behind.
+ */
+void LogTryFlush();
+
+/** Messages longer than LogMessageSize - 1 characters are truncated. */
+void LogMessage(const char *fmt, ...);
+const size_t LogMessageSize = 232;
+
 #ifndef LOG
-#define LOG(fmt, ...) do { \
-	tm logNow = TimeForLog(); \
-	fprintf(LogFile, "[%02d:%02d:%02d] " fmt "\n", logNow.tm_hour, logNow.tm_min, logNow.tm_sec, __VA_ARGS__); \
-	LogFlush(); \
-} while (0)
+#define LOG(fmt, ...) LogMessage(fmt, __VA_ARGS__)
 #endif
 
 #define TRACE(...) {}
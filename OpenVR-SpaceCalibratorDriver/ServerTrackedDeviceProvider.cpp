@@ -3,14 +3,15 @@
 #include "InterfaceHookInjector.h"
 #include "IsometryTransform.h"
 
+#include <cstring>
 #include <random>
 
 vr::EVRInitError ServerTrackedDeviceProvider::Init(vr::IVRDriverContext *pDriverContext)
 {
 	TRACE("ServerTrackedDeviceProvider::Init()");
+	StartLogWriter();
 	VR_INIT_SERVER_DRIVER_CONTEXT(pDriverContext);
 
-	memset(transforms, 0, vr::k_unMaxTrackedDeviceCount * sizeof DeviceTransform);
 	memset(&alignmentSpeedParams, 0, sizeof alignmentSpeedParams);
 
 	alignmentSpeedParams.thr_rot_tiny = 0.1f * (EIGEN_PI / 180.0f);
@@ -25,9 +26,20 @@ vr::EVRInitError ServerTrackedDeviceProvider::Init(vr::IVRDriverContext *pDriver
 	alignmentSpeedParams.align_speed_small = 0.2f;
 	alignmentSpeedParams.align_speed_large = 2.0f;
 
+	// Before the hooks go in, so every device starts out with the defaults even if its first read of the slot fails.
+	alignmentSpeedSlot.Publish(alignmentSpeedParams);
+	for (auto& device : transforms)
+		device.alignmentSpeedParams = alignmentSpeedParams;
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	secondsPerTick = 1.0 / (double)freq.QuadPart;
+
 	InjectHooks(this, pDriverContext);
 	server.Run();
 	shmem.Create(OPENVR_SPACECALIBRATOR_SHMEM_NAME);
+	transformShmem.Create(OPENVR_SPACECALIBRATOR_CONTROL_SHMEM_NAME);
+	stats.Create(OPENVR_SPACECALIBRATOR_STATS_SHMEM_NAME);
 
 	debugTransform = Eigen::Vector3d::Zero();
 	debugRotation = Eigen::Quaterniond::Identity();
@@ -40,13 +52,14 @@ void ServerTrackedDeviceProvider::Cleanup()
 	TRACE("ServerTrackedDeviceProvider::Cleanup()");
 	server.Stop();
 	shmem.Close();
+	transformShmem.Close();
 	DisableHooks();
+	stats.Close();
+	StopLogWriter();
 	VR_CLEANUP_SERVER_DRIVER_CONTEXT();
 }
 
 namespace {
-
-
 	vr::HmdQuaternion_t convert(const Eigen::Quaterniond& q) {
 		vr::HmdQuaternion_t result;
 		result.w = q.w();
@@ -94,62 +107,31 @@ namespace {
 }
 
 
-/**
- * This function heuristically evaluates the amount of drift between the src and target playspace transforms,
- * evaluated centered on the `pose` device transform. This is then used to control the speed of realignment.
- */
-ServerTrackedDeviceProvider::DeltaSize ServerTrackedDeviceProvider::GetTransformDeltaSize(
-	DeltaSize prior_delta,
-	const IsoTransform& deviceWorldPose,
-	const IsoTransform& src,
-	const IsoTransform& target
-) const {
-	const auto src_pose = src * deviceWorldPose;
-	const auto target_pose = target * deviceWorldPose;
-
-	const auto trans_delta = (src_pose.translation - target_pose.translation).squaredNorm();
-	const auto rot_delta = src_pose.rotation.angularDistance(target_pose.rotation);
-
-	DeltaSize trans_level, rot_level;
-
-	if (trans_delta > alignmentSpeedParams.thr_trans_large) trans_level = DeltaSize::LARGE;
-	else if (trans_delta > alignmentSpeedParams.thr_trans_small) trans_level = DeltaSize::SMALL;
-	else trans_level = DeltaSize::TINY;
-
-	if (rot_delta > alignmentSpeedParams.thr_rot_large) rot_level = DeltaSize::LARGE;
-	else if (rot_delta > alignmentSpeedParams.thr_rot_small) rot_level = DeltaSize::SMALL;
-	else rot_level = DeltaSize::TINY;
-
-	if (trans_level == DeltaSize::TINY && rot_level == DeltaSize::TINY) return DeltaSize::TINY;
-	else return max(prior_delta, max(trans_level, rot_level));
-}
-
-double ServerTrackedDeviceProvider::GetTransformRate(DeltaSize delta) const {
-	switch (delta) {
-	case DeltaSize::TINY: return alignmentSpeedParams.align_speed_tiny;
-	case DeltaSize::SMALL: return alignmentSpeedParams.align_speed_small;
-	default: return alignmentSpeedParams.align_speed_large;
-	}
-}
-
 /**
  * Smoothly interpolates the device active transform towards the target transform.
  */
 void ServerTrackedDeviceProvider::BlendTransform(DeviceTransform& device, const IsoTransform &deviceWorldPose) const {
-	LARGE_INTEGER timestamp, freq;
+	LARGE_INTEGER timestamp;
 	QueryPerformanceCounter(&timestamp);
-	QueryPerformanceFrequency(&freq);
 
-	double lerp = (timestamp.QuadPart - device.lastPoll.QuadPart) / (double)freq.QuadPart;
+	const double seconds = (timestamp.QuadPart - device.lastPoll.QuadPart) * secondsPerTick;
 	device.lastPoll = timestamp;
-	
-	lerp *= GetTransformRate(device.currentRate);
-	if (lerp > 1.0)
-		lerp = 1.0;
-	if (lerp < 0 || isnan(lerp))
-		lerp = 0;
 
-	device.transform = device.transform.interpolateAround(lerp, device.targetTransform, deviceWorldPose.translation);
+	const double rate = blend::TransformRate(device.alignmentSpeedParams, device.currentRate);
+	device.transform = blend::BlendTransform(device.transform, device.target.transform, deviceWorldPose.translation, seconds, rate);
+}
+
+/**
+ * Whether the active transform has reached its target. Once it has, it is set to the target exactly, and poses
+ * take the converged path in HandleDevicePoseUpdated until the target moves again.
+ */
+bool ServerTrackedDeviceProvider::HasConverged(DeviceTransform& device) const {
+	if (!blend::HasConverged(device.transform, device.target.transform))
+		return false;
+
+	device.transform = device.target.transform;
+	device.currentRate = DeltaSize::TINY;
+	return true;
 }
 
 void ServerTrackedDeviceProvider::ApplyTransform(DeviceTransform& device, vr::DriverPose_t& devicePose) const {
@@ -161,6 +143,32 @@ void ServerTrackedDeviceProvider::ApplyTransform(DeviceTransform& device, vr::Dr
 	devicePose.qWorldFromDriverRotation = convert(deviceWorldTransform.rotation);
 }
 
+/**
+ * ApplyTransform for a converged device, whose active transform does not change from pose to pose. Drivers
+ * normally keep their world-from-driver transform fixed too, so the composition is done once, and later poses
+ * with the same world-from-driver transform just get the cached result.
+ */
+void ServerTrackedDeviceProvider::ApplyConvergedTransform(DeviceTransform& device, vr::DriverPose_t& devicePose) const {
+	WorldFromDriver& cache = device.composedFrom;
+	if (device.composedValid
+		&& memcmp(&cache.rotation, &devicePose.qWorldFromDriverRotation, sizeof cache.rotation) == 0
+		&& memcmp(cache.translation, devicePose.vecWorldFromDriverTranslation, sizeof cache.translation) == 0)
+	{
+		devicePose.qWorldFromDriverRotation = device.composed.rotation;
+		memcpy(devicePose.vecWorldFromDriverTranslation, device.composed.translation, sizeof device.composed.translation);
+		return;
+	}
+
+	cache.rotation = devicePose.qWorldFromDriverRotation;
+	memcpy(cache.translation, devicePose.vecWorldFromDriverTranslation, sizeof cache.translation);
+
+	ApplyTransform(device, devicePose);
+
+	device.composed.rotation = devicePose.qWorldFromDriverRotation;
+	memcpy(device.composed.translation, devicePose.vecWorldFromDriverTranslation, sizeof device.composed.translation);
+	device.composedValid = true;
+}
+
 
 inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t &lhs, const vr::HmdQuaternion_t &rhs) {
 	return {
@@ -178,36 +186,165 @@ inline vr::HmdVector3d_t quaternionRotateVector(const vr::HmdQuaternion_t& quat,
 	return { rotatedVectorQuat.x, rotatedVectorQuat.y, rotatedVectorQuat.z };
 }
 
-void ServerTrackedDeviceProvider::SetDeviceTransform(const protocol::SetDeviceTransform& newTransform)
+/**
+ * Merges an update into the device's target and publishes the result to the pose hook. Callers hold
+ * transformWriteMutex.
+ *
+ * The application re-sends its whole table every scan, so most updates change nothing. Those are not published:
+ * every publish sends the pose hook's device back from the converged path to blending, and a snap would also
+ * jump it to a target it may still be blending towards.
+ */
+void ServerTrackedDeviceProvider::WriteDeviceTransform(const protocol::SetDeviceTransform& newTransform)
 {
-	auto &tf = transforms[newTransform.openVRID];
-	tf.enabled = newTransform.enabled;
+	auto &target = targets[newTransform.openVRID];
+	bool changed = false;
+
+	if (target.enabled != newTransform.enabled) {
+		target.enabled = newTransform.enabled;
+		changed = true;
+	}
 
 	if (newTransform.updateTranslation) {
-		tf.targetTransform.translation = convert(newTransform.translation);
-		if (!newTransform.lerp) {
-			tf.transform.translation = tf.targetTransform.translation;
+		const Eigen::Vector3d translation = convert(newTransform.translation);
+		if (translation != target.transform.translation) {
+			target.transform.translation = translation;
+			if (!newTransform.lerp) {
+				target.translationSnaps++;
+			}
+			changed = true;
 		}
 	}
 
 	if (newTransform.updateRotation) {
-		tf.targetTransform.rotation = convert(newTransform.rotation);
+		const Eigen::Quaterniond rotation = convert(newTransform.rotation);
+		if (rotation.coeffs() != target.transform.rotation.coeffs()) {
+			target.transform.rotation = rotation;
+			if (!newTransform.lerp) {
+				target.rotationSnaps++;
+			}
+			changed = true;
+		}
+	}
+
+	if (newTransform.updateScale && target.scale != newTransform.scale) {
+		target.scale = newTransform.scale;
+		changed = true;
+	}
+
+	if (target.quash != newTransform.quash) {
+		target.quash = newTransform.quash;
+		changed = true;
+	}
+
+	if (changed)
+		targetSlots[newTransform.openVRID].Publish(target);
+}
+
+/**
+ * Publishes new alignment speed parameters to the pose hook, if they differ from the current ones. Callers hold
+ * transformWriteMutex.
+ */
+void ServerTrackedDeviceProvider::WriteAlignmentSpeedParams(const protocol::AlignmentSpeedParams& params)
+{
+	if (memcmp(&params, &alignmentSpeedParams, sizeof params) == 0)
+		return;
 
-		if (!newTransform.lerp) {
-			tf.transform.rotation = tf.targetTransform.rotation;
+	alignmentSpeedParams = params;
+	alignmentSpeedSlot.Publish(alignmentSpeedParams);
+}
+
+void ServerTrackedDeviceProvider::WriteDeviceTransforms(const protocol::SetDeviceTransforms& newTransforms)
+{
+	WriteAlignmentSpeedParams(newTransforms.alignmentSpeedParams);
+
+	for (uint32_t i = 0; i < newTransforms.count && i < vr::k_unMaxTrackedDeviceCount; i++) {
+		if (newTransforms.transforms[i].openVRID < vr::k_unMaxTrackedDeviceCount) {
+			WriteDeviceTransform(newTransforms.transforms[i]);
 		}
 	}
+}
 
-	if (newTransform.updateScale)
-		tf.scale = newTransform.scale;
+void ServerTrackedDeviceProvider::SetDeviceTransform(const protocol::SetDeviceTransform& newTransform)
+{
+	if (newTransform.openVRID >= vr::k_unMaxTrackedDeviceCount)
+		return;
+
+	std::lock_guard<std::mutex> lock(transformWriteMutex);
+	WriteDeviceTransform(newTransform);
+}
+
+/**
+ * Applies a whole table of device transforms, along with the alignment speed, in one go.
+ */
+void ServerTrackedDeviceProvider::SetDeviceTransforms(const protocol::SetDeviceTransforms& newTransforms)
+{
+	std::lock_guard<std::mutex> lock(transformWriteMutex);
+	WriteDeviceTransforms(newTransforms);
+}
 
-	tf.quash = newTransform.quash;
+void ServerTrackedDeviceProvider::HandleSetAlignmentSpeedParams(const protocol::AlignmentSpeedParams& params)
+{
+	std::lock_guard<std::mutex> lock(transformWriteMutex);
+	WriteAlignmentSpeedParams(params);
+}
+
+/**
+ * Applies the transform table the application published to shared memory, if it changed since we last did.
+ * Costs one atomic load when it has not. Pose updates can come from several threads; one of them applies a
+ * new table while the others carry on with the current one, as does everyone while the IPC thread is
+ * setting a transform.
+ */
+void ServerTrackedDeviceProvider::PollDeviceTransforms()
+{
+	const uint64_t generation = transformShmem.Generation();
+	if (generation == appliedTransformGeneration.load(std::memory_order_relaxed))
+		return;
+
+	std::unique_lock<std::mutex> lock(transformWriteMutex, std::try_to_lock);
+	if (!lock)
+		return;
+
+	protocol::SetDeviceTransforms table;
+	uint64_t tableGeneration;
+	if (!transformShmem.Read(table, tableGeneration) || tableGeneration == appliedTransformGeneration.load(std::memory_order_relaxed))
+		return;
+
+	WriteDeviceTransforms(table);
+	appliedTransformGeneration.store(tableGeneration, std::memory_order_relaxed);
+}
+
+/**
+ * Picks up the newest alignment speed and the device's newest target, if there are new ones and they could be
+ * read in one piece. Targets set without lerping move the current transform along with them.
+ */
+void ServerTrackedDeviceProvider::UpdateTarget(DeviceTransform& device, uint32_t openVRID) const
+{
+	alignmentSpeedSlot.Read(device.alignmentSpeedParams, device.seenAlignmentSpeed);
+
+	const uint32_t translationSnaps = device.target.translationSnaps;
+	const uint32_t rotationSnaps = device.target.rotationSnaps;
+
+	if (!targetSlots[openVRID].Read(device.target, device.seenTarget))
+		return;
+
+	if (device.target.translationSnaps != translationSnaps)
+		device.transform.translation = device.target.transform.translation;
+	if (device.target.rotationSnaps != rotationSnaps)
+		device.transform.rotation = device.target.transform.rotation;
+
+	// Blending resumes from now, rather than from the last pose that blended.
+	if (device.converged)
+		QueryPerformanceCounter(&device.lastPoll);
+	device.converged = false;
+	device.composedValid = false;
 }
 
 bool ServerTrackedDeviceProvider::HandleDevicePoseUpdated(uint32_t openVRID, vr::DriverPose_t &pose)
 {
+	PollDeviceTransforms();
+
 	// Apply debug pose before anything else
-	if (openVRID > 0) {
+	if (openVRID > 0 && debugOffsetApplied.load(std::memory_order_acquire)) {
 		auto dbgPos = convert(pose.vecPosition) + debugTransform;
 		auto dbgRot = convert(pose.qRotation) * debugRotation;
 		pose.qRotation = convert(dbgRot);
@@ -219,24 +356,32 @@ bool ServerTrackedDeviceProvider::HandleDevicePoseUpdated(uint32_t openVRID, vr:
 	shmem.SetPose(openVRID, pose);
 
 	auto& tf = transforms[openVRID];
+	UpdateTarget(tf, openVRID);
 
-	if (tf.quash) {
+	if (tf.target.quash) {
 		pose.vecPosition[0] = -pose.vecWorldFromDriverTranslation[0];
 		pose.vecPosition[1] = -pose.vecWorldFromDriverTranslation[1] + 9001; // put it 9001m above the origin
 		pose.vecPosition[2] = -pose.vecWorldFromDriverTranslation[2];
-	} else if (tf.enabled)
+	} else if (tf.target.enabled)
 	{
 		// @TODO: Offset, scale, and re-offset
-		pose.vecPosition[0] *= tf.scale;
-		pose.vecPosition[1] *= tf.scale;
-		pose.vecPosition[2] *= tf.scale;
-
-		auto deviceWorldPose = toIsoPose(pose);
-		tf.currentRate = GetTransformDeltaSize(tf.currentRate, deviceWorldPose, tf.transform, tf.targetTransform);
-		double lerp = GetTransformRate(tf.currentRate);
+		pose.vecPosition[0] *= tf.target.scale;
+		pose.vecPosition[1] *= tf.target.scale;
+		pose.vecPosition[2] *= tf.target.scale;
 
-		BlendTransform(tf, deviceWorldPose);
-		ApplyTransform(tf, pose);
+		if (tf.converged)
+		{
+			ApplyConvergedTransform(tf, pose);
+		}
+		else
+		{
+			auto deviceWorldPose = toIsoPose(pose);
+			tf.currentRate = blend::TransformDeltaSize(tf.alignmentSpeedParams, tf.currentRate, deviceWorldPose, tf.transform, tf.target.transform);
+
+			BlendTransform(tf, deviceWorldPose);
+			tf.converged = HasConverged(tf);
+			ApplyTransform(tf, pose);
+		}
 	}
 
 	return true;
@@ -250,6 +395,7 @@ void ServerTrackedDeviceProvider::HandleApplyRandomOffset() {
 
 	debugTransform = posOffset;
 	debugRotation = Eigen::Quaterniond::Identity();
+	debugOffsetApplied.store(true, std::memory_order_release);
 
 	std::ostringstream oss;
 	oss << "Applied random offset: " << posOffset << " from init " << init << std::endl;
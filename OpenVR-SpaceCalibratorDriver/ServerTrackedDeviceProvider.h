@@ -5,11 +5,16 @@
 #include "IPCServer.h"
 #include "../Protocol.h"
 #include "IsometryTransform.h"
+#include "DeviceTransformSlot.h"
+#include "TransformBlend.h"
 
 #include <Eigen/Dense>
 
 #include <openvr_driver.h>
 
+#include <atomic>
+#include <mutex>
+
 
 class ServerTrackedDeviceProvider : public vr::IServerTrackedDeviceProvider
 {
@@ -43,49 +48,73 @@ public:
 
 	ServerTrackedDeviceProvider() : server(this) { }
 	void SetDeviceTransform(const protocol::SetDeviceTransform &newTransform);
+	void SetDeviceTransforms(const protocol::SetDeviceTransforms &newTransforms);
 	bool HandleDevicePoseUpdated(uint32_t openVRID, vr::DriverPose_t &pose);
 	void HandleApplyRandomOffset();
-	void HandleSetAlignmentSpeedParams(const protocol::AlignmentSpeedParams params) {
-		alignmentSpeedParams = params;
+	void RecordPoseHook(uint32_t openVRID, protocol::DriverStatsShmem::HookInterface hookInterface, int64_t entered, int64_t handled, int64_t exited) {
+		stats.Record(openVRID, hookInterface, entered, handled, exited);
 	}
+	void HandleSetAlignmentSpeedParams(const protocol::AlignmentSpeedParams &params);
 
 private:
 	IPCServer server;
 	protocol::DriverPoseShmem shmem;
+	protocol::DriverStatsShmem stats;
+
+	protocol::DeviceTransformShmem transformShmem;
+	std::atomic<uint64_t> appliedTransformGeneration { 0 };
 
-	enum DeltaSize {
-		TINY,
-		SMALL,
-		LARGE
+	typedef blend::DeltaSize DeltaSize;
+
+	struct WorldFromDriver
+	{
+		vr::HmdQuaternion_t rotation;
+		double translation[3];
 	};
 
+	/** Per-device state of the pose hook, which only it touches. */
 	struct DeviceTransform
 	{
-		bool enabled = false;
-		bool quash = false;
-		IsoTransform transform, targetTransform;
-		double scale;
-		LARGE_INTEGER lastPoll;
+		DeviceTarget target;
+		uint32_t seenTarget = 0;
+		IsoTransform transform; // blended towards target.transform
+		LARGE_INTEGER lastPoll = {};
 		DeltaSize currentRate = DeltaSize::TINY;
+		protocol::AlignmentSpeedParams alignmentSpeedParams;
+		uint32_t seenAlignmentSpeed = 0;
+
+		// Set once transform has reached the target; see ApplyConvergedTransform.
+		bool converged = false;
+		bool composedValid = false;
+		WorldFromDriver composedFrom, composed;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 	};
 
+	// Targets and alignment speed as set over IPC or the transform table, and their handoff to the pose hook.
+	// Setters hold the mutex.
+	std::mutex transformWriteMutex;
+	DeviceTarget targets[vr::k_unMaxTrackedDeviceCount];
+	DeviceTransformSlot targetSlots[vr::k_unMaxTrackedDeviceCount];
+	protocol::AlignmentSpeedParams alignmentSpeedParams;
+	SeqlockSlot<protocol::AlignmentSpeedParams> alignmentSpeedSlot;
+
 	DeviceTransform transforms[vr::k_unMaxTrackedDeviceCount];
 	Eigen::Vector3d debugTransform;
 	Eigen::Quaterniond debugRotation;
+	std::atomic<bool> debugOffsetApplied { false };
 
-	DeltaSize currentDeltaSpeed[vr::k_unMaxTrackedDeviceCount];
-
-	protocol::AlignmentSpeedParams alignmentSpeedParams;
-
-	DeltaSize GetTransformDeltaSize(
-		DeltaSize prior_delta,
-		const IsoTransform& deviceWorldPose,
-		const IsoTransform& src,
-		const IsoTransform& target
-	) const;
+	double secondsPerTick = 0.0; // of QueryPerformanceCounter
 
-	double GetTransformRate(DeltaSize delta) const;
+	DeltaSize currentDeltaSpeed[vr::k_unMaxTrackedDeviceCount];
 
+	void WriteAlignmentSpeedParams(const protocol::AlignmentSpeedParams &params);
+	void WriteDeviceTransform(const protocol::SetDeviceTransform &newTransform);
+	void WriteDeviceTransforms(const protocol::SetDeviceTransforms &newTransforms);
+	void PollDeviceTransforms();
+	void UpdateTarget(DeviceTransform& device, uint32_t openVRID) const;
 	void BlendTransform(DeviceTransform& device, const IsoTransform& deviceWorldPose) const;
+	bool HasConverged(DeviceTransform& device) const;
 	void ApplyTransform(DeviceTransform& device, vr::DriverPose_t& devicePose) const;
+	void ApplyConvergedTransform(DeviceTransform& device, vr::DriverPose_t& devicePose) const;
 };
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../Protocol.h"
+#include "IsometryTransform.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * How the pose hook moves a device's active transform towards the target the calibrator set for it. None of
+ * this touches OpenVR, Windows or a clock: the caller passes in how much time went by, so that the replayer
+ * can run the very same steps on recorded poses.
+ */
+namespace blend
+{
+	enum DeltaSize
+	{
+		TINY,
+		SMALL,
+		LARGE
+	};
+
+	// Once the blended transform is this close to its target (metres, radians), it snaps to it and stops blending.
+	const double ConvergedTranslation = 1e-6;
+	const double ConvergedRotation = 1e-6;
+
+	/**
+	 * This function heuristically evaluates the amount of drift between the src and target playspace transforms,
+	 * evaluated centered on the `deviceWorldPose` device transform. This is then used to control the speed of
+	 * realignment.
+	 */
+	inline DeltaSize TransformDeltaSize(
+		const protocol::AlignmentSpeedParams& params,
+		DeltaSize priorDelta,
+		const IsoTransform& deviceWorldPose,
+		const IsoTransform& src,
+		const IsoTransform& target
+	) {
+		const auto src_pose = src * deviceWorldPose;
+		const auto target_pose = target * deviceWorldPose;
+
+		const auto trans_delta = (src_pose.translation - target_pose.translation).squaredNorm();
+		const auto rot_delta = src_pose.rotation.angularDistance(target_pose.rotation);
+
+		DeltaSize trans_level, rot_level;
+
+		if (trans_delta > params.thr_trans_large) trans_level = DeltaSize::LARGE;
+		else if (trans_delta > params.thr_trans_small) trans_level = DeltaSize::SMALL;
+		else trans_level = DeltaSize::TINY;
+
+		if (rot_delta > params.thr_rot_large) rot_level = DeltaSize::LARGE;
+		else if (rot_delta > params.thr_rot_small) rot_level = DeltaSize::SMALL;
+		else rot_level = DeltaSize::TINY;
+
+		if (trans_level == DeltaSize::TINY && rot_level == DeltaSize::TINY) return DeltaSize::TINY;
+		else return std::max<DeltaSize>(priorDelta, std::max<DeltaSize>(trans_level, rot_level));
+	}
+
+	inline double TransformRate(const protocol::AlignmentSpeedParams& params, DeltaSize delta) {
+		switch (delta) {
+		case DeltaSize::TINY: return params.align_speed_tiny;
+		case DeltaSize::SMALL: return params.align_speed_small;
+		default: return params.align_speed_large;
+		}
+	}
+
+	/**
+	 * Smoothly interpolates the active transform towards the target transform, by as much as `rate` allows in
+	 * `seconds`, around the device's world position.
+	 */
+	inline IsoTransform BlendTransform(const IsoTransform& transform, const IsoTransform& target, const Eigen::Vector3d& devicePosition, double seconds, double rate) {
+		double lerp = seconds * rate;
+		if (lerp > 1.0)
+			lerp = 1.0;
+		if (lerp < 0 || std::isnan(lerp))
+			lerp = 0;
+
+		return transform.interpolateAround(lerp, target, devicePosition);
+	}
+
+	/** Whether the active transform has reached its target. */
+	inline bool HasConverged(const IsoTransform& transform, const IsoTransform& target) {
+		if ((transform.translation - target.translation).squaredNorm() > ConvergedTranslation * ConvergedTranslation)
+			return false;
+		return transform.rotation.angularDistance(target.rotation) <= ConvergedRotation;
+	}
+}
@@ -15,6 +15,11 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
 		break;
 	case DLL_PROCESS_DETACH:
 		LOG("OpenVR-SpaceCalibratorDriver unloaded");
+
+		// When the process is exiting (lpReserved set), every other thread, the log writer included, has already
+		// been killed, possibly while holding a lock; Cleanup has normally flushed the log by then anyway.
+		if (lpReserved == NULL)
+			LogTryFlush();
 		break;
 	case DLL_THREAD_ATTACH:
 	case DLL_THREAD_DETACH:
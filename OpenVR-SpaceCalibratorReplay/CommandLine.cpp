@@ -0,0 +1,83 @@
+#include "CommandLine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+bool ParseSettingsArgument(int argc, char **argv, int &i, Replayer::Settings &settings, std::string &error)
+{
+	const std::string arg = argv[i];
+	const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+	if (arg == "-oneshot") settings.continuous = false;
+	else if (arg == "-staticrecal") settings.enableStaticRecalibration = true;
+	else if (arg == "-lockrelative") settings.lockRelativePosition = true;
+	else if (arg == "-window" || arg == "-threshold" || arg == "-pairs" || arg == "-pairbudget" || arg == "-tick")
+	{
+		if (!value)
+		{
+			error = arg + " needs a value";
+			return true;
+		}
+		i++;
+
+		const std::string text = value;
+		if (arg == "-window") settings.windowSize = (size_t)std::max<int>(atoi(value), 1);
+		else if (arg == "-threshold") settings.threshold = atof(value);
+		else if (arg == "-pairbudget") settings.pairBudget = (size_t)std::max<int>(atoi(value), 1);
+		else if (arg == "-tick")
+		{
+			settings.tickInterval = atof(value);
+			if (!(settings.tickInterval > 0.0)) error = "-tick needs a positive interval";
+		}
+		else if (text == "all") settings.pairSelection = CalibrationCalc::PairSelection::All;
+		else if (text == "random") settings.pairSelection = CalibrationCalc::PairSelection::RandomBudget;
+		else if (text == "stratified") settings.pairSelection = CalibrationCalc::PairSelection::Stratified;
+		else error = "unknown pair selection: " + text;
+	}
+	else return false;
+
+	return true;
+}
+
+void PrintSettingsUsage(FILE *out)
+{
+	fprintf(out,
+		"  -window <n>         samples per solve (default 100; the app uses 100, 250 or 500)\n"
+		"  -oneshot            solve one-shot calibrations instead of continuous ones\n"
+		"  -threshold <x>      continuous calibration threshold (default 1.5)\n"
+		"  -staticrecal        enable static recalibration\n"
+		"  -lockrelative       lock the relative position\n"
+		"  -pairs <mode>       all, random or stratified (default all)\n"
+		"  -pairbudget <n>     pairs per sample for random and stratified (default 64)\n"
+		"  -tick <seconds>     calibration tick interval (default 0.05)\n");
+}
+
+bool ParseVector(const char *text, double out[3])
+{
+	return sscanf(text, "%lf,%lf,%lf", &out[0], &out[1], &out[2]) == 3;
+}
+
+void WriteCsvValue(FILE *out, double value)
+{
+	if (std::isnan(value))
+		fprintf(out, ",");
+	else
+		fprintf(out, ",%.6g", value);
+}
+
+double Percentile(std::vector<double> values, double p)
+{
+	if (values.empty()) return 0.0;
+	std::sort(values.begin(), values.end());
+	const size_t i = std::min<size_t>((size_t)(p * values.size()), values.size() - 1);
+	return values[i];
+}
+
+double Mean(const std::vector<double> &values)
+{
+	if (values.empty()) return 0.0;
+	double sum = 0.0;
+	for (double value : values) sum += value;
+	return sum / values.size();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Replayer.h"
+
+/*
+ * Command line handling shared by the replay tools.
+ */
+
+/*
+ * If argv[i] is one of the calibration settings options, applies it and moves i past its value. Returns false
+ * if it is not; sets error if it is, but its value is missing or invalid.
+ */
+bool ParseSettingsArgument(int argc, char **argv, int &i, Replayer::Settings &settings, std::string &error);
+void PrintSettingsUsage(FILE *out);
+
+/* Parses "x,y,z" into three numbers. */
+bool ParseVector(const char *text, double out[3]);
+
+/* Writes ",value", or just "," for NaN. */
+void WriteCsvValue(FILE *out, double value);
+
+double Percentile(std::vector<double> values, double p);
+double Mean(const std::vector<double> &values);
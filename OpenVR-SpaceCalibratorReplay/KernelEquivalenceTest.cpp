@@ -0,0 +1,152 @@
+#include "SyntheticPoses.h"
+#include "../OpenVR-SpaceCalibrator/CalibrationCalc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+/*
+ * Checks that CalibrationCalc's batch rotation pair kernel gives the same calibrations as the scalar one it
+ * replaced. Both kernels are fed the same noisy synthetic samples, for every trajectory and pair selection, and
+ * each one-shot solve is compared between the two. On the figure eight, which constrains every axis, the solves
+ * are also checked against the ground truth, so that the comparison is known to be between working calibrations;
+ * the other trajectories are too poorly conditioned for a five second window to land near it.
+ *
+ * The kernels decide which pairs are too small a rotation to use differently (thresholds on the trace rather than
+ * on the angle), so pairs right at the threshold may go either way; hence a tolerance rather than exact equality.
+ */
+
+namespace {
+	const double MaxKernelRotationDeg = 0.01;
+	const double MaxKernelTranslationMm = 0.1;
+	const double MaxTruthRotationDeg = 0.5;
+	const double MaxTruthTranslationMm = 10.0;
+
+	Pose ConvertPose(const protocol::CompactPose &pose) {
+		Eigen::Quaterniond rot(pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3]);
+		rot.normalize();
+		return Pose(rot, Eigen::Vector3d(pose.position[0], pose.position[1], pose.position[2]));
+	}
+
+	double RotationDeg(const Eigen::AffineCompact3d &a, const Eigen::AffineCompact3d &b) {
+		return Eigen::Quaterniond(a.rotation()).angularDistance(Eigen::Quaterniond(b.rotation())) * 180.0 / EIGEN_PI;
+	}
+
+	double TranslationMm(const Eigen::AffineCompact3d &a, const Eigen::AffineCompact3d &b) {
+		return (a.translation() - b.translation()).norm() * 1000.0;
+	}
+
+	/* Runs one trajectory through both kernels; returns the number of failed checks. */
+	int Compare(const char *name, SyntheticPoses::Trajectory trajectory, CalibrationCalc::PairSelection pairSelection) {
+		SyntheticPoses::Settings settings;
+		settings.trajectory = trajectory;
+		settings.duration = 30.0;
+		settings.positionNoise = 1.0;
+		settings.rotationNoise = 0.2;
+		SyntheticPoses poses(settings);
+
+		CalibrationCalc scalar, batch;
+		scalar.rotationPairKernel = CalibrationCalc::RotationPairKernel::Scalar;
+		batch.rotationPairKernel = CalibrationCalc::RotationPairKernel::Batch;
+		for (CalibrationCalc *calc : { &scalar, &batch }) {
+			calc->pairSelection = pairSelection;
+			calc->enableStaticRecalibration = false;
+		}
+
+		protocol::CompactPose latest[2] = {};
+		double nextSample = 0.0;
+		int solves = 0, failures = 0;
+		double worstRotation = 0.0, worstTranslation = 0.0;
+
+		protocol::CompactPose pose;
+		while (poses.Next(pose)) {
+			latest[pose.deviceId == SyntheticPoses::ReferenceID ? 0 : 1] = pose;
+
+			const double time = (double)pose.sampleTime / SyntheticPoses::TimestampFrequency;
+			if (time < nextSample || !latest[0].poseIsValid() || !latest[1].poseIsValid()) continue;
+			nextSample += 0.05;
+
+			const Sample sample(ConvertPose(latest[0]), ConvertPose(latest[1]));
+			scalar.PushSample(sample);
+			batch.PushSample(sample);
+			if (batch.SampleCount() < CalibrationCalc::DefaultWindowSize) continue;
+
+			scalar.ComputeOneshot();
+			batch.ComputeOneshot();
+			solves++;
+
+			const IsoTransform truthIso = poses.Truth(time);
+			Eigen::AffineCompact3d truth(truthIso.rotation);
+			truth.pretranslate(truthIso.translation);
+
+			if (scalar.isValid() != batch.isValid()) {
+				fprintf(stderr, "%s: solve %d valid with one kernel only\n", name, solves);
+				failures++;
+			}
+			else if (batch.isValid()) {
+				const double rotation = RotationDeg(scalar.Transformation(), batch.Transformation());
+				const double translation = TranslationMm(scalar.Transformation(), batch.Transformation());
+				worstRotation = std::max<double>(worstRotation, rotation);
+				worstTranslation = std::max<double>(worstTranslation, translation);
+				if (rotation > MaxKernelRotationDeg || translation > MaxKernelTranslationMm) {
+					fprintf(stderr, "%s: solve %d differs between kernels by %g deg, %g mm\n", name, solves, rotation, translation);
+					failures++;
+				}
+
+				const double truthRotation = RotationDeg(batch.Transformation(), truth);
+				const double truthTranslation = TranslationMm(batch.Transformation(), truth);
+				if (trajectory == SyntheticPoses::Trajectory::FigureEight
+					&& (truthRotation > MaxTruthRotationDeg || truthTranslation > MaxTruthTranslationMm)) {
+					fprintf(stderr, "%s: solve %d is %g deg, %g mm from the ground truth\n", name, solves, truthRotation, truthTranslation);
+					failures++;
+				}
+			}
+
+			scalar.Clear();
+			batch.Clear();
+		}
+
+		if (solves == 0) {
+			fprintf(stderr, "%s: no solves\n", name);
+			failures++;
+		}
+
+		printf("%-28s %d solves, kernels differ by at most %.2g deg, %.2g mm\n", name, solves, worstRotation, worstTranslation);
+		return failures;
+	}
+}
+
+int main()
+{
+	const struct {
+		const char *name;
+		SyntheticPoses::Trajectory trajectory;
+	} trajectories[] = {
+		{ "figure8", SyntheticPoses::Trajectory::FigureEight },
+		{ "walking", SyntheticPoses::Trajectory::Walking },
+		{ "headyaw", SyntheticPoses::Trajectory::HeadYaw },
+	};
+	const struct {
+		const char *name;
+		CalibrationCalc::PairSelection selection;
+	} selections[] = {
+		{ "all", CalibrationCalc::PairSelection::All },
+		{ "random", CalibrationCalc::PairSelection::RandomBudget },
+		{ "stratified", CalibrationCalc::PairSelection::Stratified },
+	};
+
+	int failures = 0;
+	for (const auto &trajectory : trajectories) {
+		for (const auto &selection : selections) {
+			const std::string name = std::string(trajectory.name) + "/" + selection.name;
+			failures += Compare(name.c_str(), trajectory.trajectory, selection.selection);
+		}
+	}
+
+	if (failures) {
+		fprintf(stderr, "FAILED: %d checks\n", failures);
+		return 1;
+	}
+	return 0;
+}
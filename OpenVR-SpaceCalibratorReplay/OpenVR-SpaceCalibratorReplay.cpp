@@ -0,0 +1,152 @@
+#include "CommandLine.h"
+#include "RecordingReader.h"
+#include "Replayer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Replays a pose recording made by the application's pose recorder through the calibration and the driver's
+ * blending, headless, and writes one CSV row per solve. A summary goes to stderr.
+ */
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: spacecal-replay -reference <id> -target <id> [options] <recording>\n"
+		"\n"
+		"  -reference <id>     OpenVR device index of the reference device\n"
+		"  -target <id>        OpenVR device index of the target device\n");
+	PrintSettingsUsage(stderr);
+	fprintf(stderr,
+		"  -o <file>           write the CSV to file instead of stdout\n"
+		"  -log                echo the calibration log to stderr\n");
+}
+
+int main(int argc, char **argv)
+{
+	Replayer::Settings settings;
+	const char *recordingPath = nullptr;
+	const char *outputPath = nullptr;
+	bool echoLog = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		std::string error;
+		if (ParseSettingsArgument(argc, argv, i, settings, error))
+		{
+			if (!error.empty())
+			{
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+		}
+		else if (arg == "-reference" && hasValue) settings.referenceID = atoi(argv[++i]);
+		else if (arg == "-target" && hasValue) settings.targetID = atoi(argv[++i]);
+		else if (arg == "-o" && hasValue) outputPath = argv[++i];
+		else if (arg == "-log") echoLog = true;
+		else if (arg[0] != '-' && !recordingPath) recordingPath = argv[i];
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (!recordingPath || settings.referenceID < 0 || settings.targetID < 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	RecordingReader reader;
+	try
+	{
+		reader.Open(recordingPath);
+	}
+	catch (std::runtime_error &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	FILE *out = stdout;
+	if (outputPath)
+	{
+		out = fopen(outputPath, "w");
+		if (!out)
+		{
+			fprintf(stderr, "Failed to create %s\n", outputPath);
+			return 2;
+		}
+	}
+
+	fprintf(out, "time,samples,valid,trans_x_cm,trans_y_cm,trans_z_cm,rot_z_deg,rot_y_deg,rot_x_deg,"
+		"error_raw_mm,error_current_mm,error_relpose_mm,axis_variance,applied,compute_ms,pairing_ms,"
+		"blend_lag_mm,blend_lag_deg\n");
+
+	Replayer replayer(settings, reader.Header().timestampFrequency, [&](const Replayer::Solve &solve) {
+		fprintf(out, "%.4f,%zu,%d", solve.time, solve.samples, solve.valid ? 1 : 0);
+		for (int i = 0; i < 3; i++) WriteCsvValue(out, solve.valid ? solve.translation(i) : NAN);
+		for (int i = 0; i < 3; i++) WriteCsvValue(out, solve.valid ? solve.rotation(i) : NAN);
+		WriteCsvValue(out, solve.errorRawComputed);
+		WriteCsvValue(out, solve.errorCurrentCal);
+		WriteCsvValue(out, solve.errorByRelPose);
+		WriteCsvValue(out, solve.axisIndependence);
+		fprintf(out, ",%s", solve.calibrationApplied == 1 ? "FULL" : solve.calibrationApplied == 0 ? "STATIC" : "");
+		WriteCsvValue(out, solve.computeMs);
+		WriteCsvValue(out, solve.pairingMs);
+		WriteCsvValue(out, solve.blendLagMm);
+		WriteCsvValue(out, solve.blendLagDeg);
+		fprintf(out, "\n");
+
+		if (echoLog && !solve.log.empty())
+			fprintf(stderr, "%s", solve.log.c_str());
+	});
+
+	const auto start = std::chrono::steady_clock::now();
+
+	recording::ChunkHeader chunk;
+	std::vector<protocol::CompactPose> poses;
+	uint64_t chunks = 0, droppedPoses = 0;
+	while (reader.NextChunk(chunk, poses))
+	{
+		chunks++;
+		droppedPoses += chunk.droppedPoses;
+		for (const auto &pose : poses)
+			replayer.Feed(pose);
+	}
+
+	const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (out != stdout)
+		fclose(out);
+
+	const Replayer::Totals &totals = replayer.GetTotals();
+	fprintf(stderr, "Replayed %.1f s of poses in %.2f s (%.0fx): %llu poses in %llu chunks%s, %llu lost while recording\n",
+		totals.virtualSeconds, wallSeconds, wallSeconds > 0.0 ? totals.virtualSeconds / wallSeconds : 0.0,
+		(unsigned long long)totals.poses, (unsigned long long)chunks, reader.IsComplete() ? "" : " (recording cut short)",
+		(unsigned long long)droppedPoses);
+	fprintf(stderr, "%llu ticks, %llu samples, %llu solves (%llu valid)\n",
+		(unsigned long long)totals.ticks, (unsigned long long)totals.samples,
+		(unsigned long long)totals.solves, (unsigned long long)totals.validSolves);
+	if (!totals.computeMs.empty())
+	{
+		fprintf(stderr, "Solve time in ms: mean %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+			Mean(totals.computeMs), Percentile(totals.computeMs, 0.5), Percentile(totals.computeMs, 0.99),
+			Percentile(totals.computeMs, 1.0));
+	}
+	fprintf(stderr, "Target device: %llu blend steps, %.0f ns each, %llu poses already converged\n",
+		(unsigned long long)totals.blendSteps, totals.blendSteps ? totals.blendSeconds * 1e9 / totals.blendSteps : 0.0,
+		(unsigned long long)totals.convergedPoses);
+
+	return 0;
+}
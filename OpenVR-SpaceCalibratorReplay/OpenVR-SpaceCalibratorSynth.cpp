@@ -0,0 +1,226 @@
+#include "CommandLine.h"
+#include "Replayer.h"
+#include "SyntheticPoses.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+ * Benchmarks the calibration against a known ground truth: generates the poses of a rigidly attached reference and
+ * target device, feeds them through the same calibration and blending as spacecal-replay, and compares every
+ * solve with the transform it should have found. Writes one CSV row per solve, and a summary to stderr.
+ */
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"usage: spacecal-synth [options]\n"
+		"\n"
+		"  -trajectory <name>  figure8, walking or headyaw (default figure8)\n"
+		"  -duration <s>       seconds of poses to generate (default 60)\n"
+		"  -speed <x>          how fast to trace the trajectory (default 1)\n"
+		"  -truth <x,y,z>      translation from target space to reference space, in cm (default 30,-10,50)\n"
+		"  -truthrot <z,y,x>   rotation from target space to reference space, in degrees (default 0,40,0)\n"
+		"  -drift <x,y,z>      drift of the translation, in mm per minute (default none)\n"
+		"  -driftyaw <deg>     drift of the rotation about the vertical axis, in degrees per minute (default none)\n"
+		"  -offset <x,y,z>     where the target sits on the reference, in cm (default 5,2,-3)\n"
+		"  -offsetrot <z,y,x>  how the target sits on the reference, in degrees (default 10,20,5)\n"
+		"  -posnoise <mm>      standard deviation of the position noise (default 0)\n"
+		"  -rotnoise <deg>     standard deviation of the rotation noise (default 0)\n"
+		"  -dropouts <n>       target tracking losses per minute (default 0)\n"
+		"  -dropoutlength <s>  length of each tracking loss (default 0.5)\n"
+		"  -skew <ms>          how much older the target's poses are than the reference's (default 0)\n"
+		"  -rate <hz>          pose rate of both devices (default 250)\n"
+		"  -refrate <hz>       pose rate of the reference device\n"
+		"  -targetrate <hz>    pose rate of the target device\n"
+		"  -seed <n>           seed for the noise and the dropouts (default 1)\n");
+	PrintSettingsUsage(stderr);
+	fprintf(stderr,
+		"  -o <file>           write the CSV to file instead of stdout\n"
+		"  -log                echo the calibration log to stderr\n");
+}
+
+static bool ParseVectorArgument(const char *text, Eigen::Vector3d &out)
+{
+	double v[3];
+	if (!ParseVector(text, v)) return false;
+	out = Eigen::Vector3d(v[0], v[1], v[2]);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	SyntheticPoses::Settings synth;
+	Replayer::Settings settings;
+	settings.referenceID = SyntheticPoses::ReferenceID;
+	settings.targetID = SyntheticPoses::TargetID;
+	const char *outputPath = nullptr;
+	bool echoLog = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		std::string error;
+		if (ParseSettingsArgument(argc, argv, i, settings, error))
+		{
+			if (!error.empty())
+			{
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "-h" || arg == "-help")
+		{
+			PrintUsage();
+			return 0;
+		}
+
+		bool ok = true;
+		if (arg == "-log") echoLog = true;
+		else if (!value) ok = false;
+		else
+		{
+			i++;
+			const std::string text = value;
+			if (arg == "-trajectory")
+			{
+				if (text == "figure8") synth.trajectory = SyntheticPoses::Trajectory::FigureEight;
+				else if (text == "walking") synth.trajectory = SyntheticPoses::Trajectory::Walking;
+				else if (text == "headyaw") synth.trajectory = SyntheticPoses::Trajectory::HeadYaw;
+				else ok = false;
+			}
+			else if (arg == "-duration") synth.duration = atof(value);
+			else if (arg == "-speed") synth.speed = atof(value);
+			else if (arg == "-truth") ok = ParseVectorArgument(value, synth.truthTranslation);
+			else if (arg == "-truthrot") ok = ParseVectorArgument(value, synth.truthRotation);
+			else if (arg == "-drift") ok = ParseVectorArgument(value, synth.driftTranslation);
+			else if (arg == "-driftyaw") synth.driftYaw = atof(value);
+			else if (arg == "-offset") ok = ParseVectorArgument(value, synth.offsetTranslation);
+			else if (arg == "-offsetrot") ok = ParseVectorArgument(value, synth.offsetRotation);
+			else if (arg == "-posnoise") synth.positionNoise = atof(value);
+			else if (arg == "-rotnoise") synth.rotationNoise = atof(value);
+			else if (arg == "-dropouts") synth.dropoutsPerMinute = atof(value);
+			else if (arg == "-dropoutlength") synth.dropoutLength = atof(value);
+			else if (arg == "-skew") synth.latencySkew = atof(value);
+			else if (arg == "-rate") synth.referenceRate = synth.targetRate = atof(value);
+			else if (arg == "-refrate") synth.referenceRate = atof(value);
+			else if (arg == "-targetrate") synth.targetRate = atof(value);
+			else if (arg == "-seed") synth.seed = (uint32_t)strtoul(value, nullptr, 10);
+			else if (arg == "-o") outputPath = value;
+			else ok = false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "Bad argument: %s%s%s\n", arg.c_str(), value ? " " : "", value ? value : "");
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (!(synth.duration > 0.0) || !(synth.referenceRate > 0.0) || !(synth.targetRate > 0.0) || synth.dropoutLength < 0.0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (outputPath)
+	{
+		out = fopen(outputPath, "w");
+		if (!out)
+		{
+			fprintf(stderr, "Failed to create %s\n", outputPath);
+			return 2;
+		}
+	}
+
+	fprintf(out, "time,samples,valid,applied,trans_err_mm,rot_err_deg,pos_err_mm,error_raw_mm,error_current_mm,"
+		"compute_ms,pairing_ms,blend_lag_mm\n");
+
+	SyntheticPoses poses(synth);
+	std::vector<double> positionErrors, rotationErrors;
+	double firstValid = NAN;
+
+	Replayer replayer(settings, SyntheticPoses::TimestampFrequency, [&](const Replayer::Solve &solve) {
+		double translationError = NAN, rotationError = NAN, positionError = NAN;
+		if (solve.valid)
+		{
+			const IsoTransform truth = poses.Truth(solve.time);
+			const IsoTransform found = Replayer::DriverTarget(solve.rotation, solve.translation);
+
+			// Where the calibration puts the target device, against where it really is.
+			const Eigen::Vector3d position = poses.TargetPose(solve.time).translation;
+			const Eigen::Vector3d tracked = truth.inverse() * position;
+
+			translationError = (found.translation - truth.translation).norm() * 1000.0;
+			rotationError = found.rotation.angularDistance(truth.rotation) * 180.0 / EIGEN_PI;
+			positionError = (found * tracked - position).norm() * 1000.0;
+
+			positionErrors.push_back(positionError);
+			rotationErrors.push_back(rotationError);
+			if (std::isnan(firstValid)) firstValid = solve.time;
+		}
+
+		fprintf(out, "%.4f,%zu,%d,%s", solve.time, solve.samples, solve.valid ? 1 : 0,
+			solve.calibrationApplied == 1 ? "FULL" : solve.calibrationApplied == 0 ? "STATIC" : "");
+		WriteCsvValue(out, translationError);
+		WriteCsvValue(out, rotationError);
+		WriteCsvValue(out, positionError);
+		WriteCsvValue(out, solve.errorRawComputed);
+		WriteCsvValue(out, solve.errorCurrentCal);
+		WriteCsvValue(out, solve.computeMs);
+		WriteCsvValue(out, solve.pairingMs);
+		WriteCsvValue(out, solve.blendLagMm);
+		fprintf(out, "\n");
+
+		if (echoLog && !solve.log.empty())
+			fprintf(stderr, "%s", solve.log.c_str());
+	});
+
+	const auto start = std::chrono::steady_clock::now();
+
+	protocol::CompactPose pose;
+	while (poses.Next(pose))
+		replayer.Feed(pose);
+
+	const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (out != stdout)
+		fclose(out);
+
+	const Replayer::Totals &totals = replayer.GetTotals();
+	fprintf(stderr, "Generated and calibrated %.1f s of poses in %.2f s (%.0fx): %llu poses, %llu samples, %llu solves (%llu valid)\n",
+		totals.virtualSeconds, wallSeconds, wallSeconds > 0.0 ? totals.virtualSeconds / wallSeconds : 0.0,
+		(unsigned long long)totals.poses, (unsigned long long)totals.samples,
+		(unsigned long long)totals.solves, (unsigned long long)totals.validSolves);
+	if (!totals.computeMs.empty())
+	{
+		fprintf(stderr, "Solve time in ms: mean %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+			Mean(totals.computeMs), Percentile(totals.computeMs, 0.5), Percentile(totals.computeMs, 0.99),
+			Percentile(totals.computeMs, 1.0));
+	}
+	if (positionErrors.empty())
+	{
+		fprintf(stderr, "No valid calibration\n");
+	}
+	else
+	{
+		fprintf(stderr, "First valid calibration at %.2f s\n", firstValid);
+		fprintf(stderr, "Target position error in mm: mean %.2f, p50 %.2f, p95 %.2f, max %.2f\n",
+			Mean(positionErrors), Percentile(positionErrors, 0.5), Percentile(positionErrors, 0.95),
+			Percentile(positionErrors, 1.0));
+		fprintf(stderr, "Rotation error in degrees: mean %.3f, p95 %.3f, max %.3f\n",
+			Mean(rotationErrors), Percentile(rotationErrors, 0.95), Percentile(rotationErrors, 1.0));
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include "RecordingReader.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	bool Seek(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+		return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+		return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+	}
+
+	uint64_t FileSize(FILE *file) {
+#ifdef _WIN32
+		_fseeki64(file, 0, SEEK_END);
+		return (uint64_t)_ftelli64(file);
+#else
+		fseeko(file, 0, SEEK_END);
+		return (uint64_t)ftello(file);
+#endif
+	}
+}
+
+RecordingReader::~RecordingReader() {
+	Close();
+}
+
+void RecordingReader::Open(const std::string &path) {
+	Close();
+
+	m_file = fopen(path.c_str(), "rb");
+	if (!m_file) {
+		throw std::runtime_error("Failed to open " + path);
+	}
+
+	if (fread(&m_header, sizeof m_header, 1, m_file) != 1 || memcmp(m_header.magic, recording::FileMagic, sizeof m_header.magic) != 0) {
+		Close();
+		throw std::runtime_error(path + " is not a pose recording");
+	}
+	if (m_header.formatVersion != recording::FormatVersion || m_header.compactPoseVersion != protocol::CompactPoseVersion) {
+		Close();
+		throw std::runtime_error(path + " has recording format " + std::to_string(m_header.formatVersion)
+			+ " with pose version " + std::to_string(m_header.compactPoseVersion) + ", which this build cannot read");
+	}
+
+	// The index is only trusted if the trailer describes exactly the bytes between the chunks and itself.
+	const uint64_t size = FileSize(m_file);
+	m_end = size;
+	m_complete = false;
+
+	recording::Trailer trailer;
+	if (size >= sizeof m_header + sizeof trailer
+		&& Seek(m_file, size - sizeof trailer)
+		&& fread(&trailer, sizeof trailer, 1, m_file) == 1
+		&& trailer.magic == recording::TrailerMagic
+		&& trailer.indexOffset >= sizeof m_header
+		&& trailer.indexOffset + (uint64_t)trailer.chunkCount * sizeof(recording::IndexEntry) == size - sizeof trailer)
+	{
+		m_end = trailer.indexOffset;
+		m_complete = true;
+	}
+
+	m_offset = sizeof m_header;
+	if (!Seek(m_file, m_offset)) {
+		Close();
+		throw std::runtime_error("Failed to read " + path);
+	}
+}
+
+void RecordingReader::Close() {
+	if (m_file) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+bool RecordingReader::NextChunk(recording::ChunkHeader &header, std::vector<protocol::CompactPose> &poses) {
+	if (!m_file || m_offset + sizeof header > m_end) return false;
+
+	if (fread(&header, sizeof header, 1, m_file) != 1 || header.magic != recording::ChunkMagic) return false;
+
+	const uint64_t size = sizeof header + (uint64_t)header.poseCount * sizeof(protocol::CompactPose);
+	if (m_offset + size > m_end) return false;
+
+	poses.resize(header.poseCount);
+	if (header.poseCount > 0 && fread(&poses[0], sizeof poses[0], poses.size(), m_file) != poses.size()) return false;
+
+	m_offset += size;
+	return true;
+}
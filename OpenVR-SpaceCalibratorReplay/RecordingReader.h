@@ -0,0 +1,43 @@
+#pragma once
+
+#include <openvr.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../PoseRecording.h"
+
+/*
+ * Reads a pose recording (see PoseRecording.h) one chunk at a time, so that recordings far larger than memory
+ * can be replayed. A recording that was cut short, and so has no index, is read up to its last whole chunk.
+ */
+class RecordingReader
+{
+public:
+	RecordingReader() { }
+	~RecordingReader();
+
+	RecordingReader(const RecordingReader&) = delete;
+	RecordingReader& operator=(const RecordingReader&) = delete;
+
+	/* Throws std::runtime_error if the file cannot be read, or is not a recording this build understands. */
+	void Open(const std::string &path);
+	void Close();
+
+	const recording::FileHeader& Header() const { return m_header; }
+
+	/* Whether the recording was finished with an index and trailer, rather than cut short. */
+	bool IsComplete() const { return m_complete; }
+
+	/* Reads the next chunk, replacing the contents of poses. Returns false once there are no more whole chunks. */
+	bool NextChunk(recording::ChunkHeader &header, std::vector<protocol::CompactPose> &poses);
+
+private:
+	FILE *m_file = nullptr;
+	recording::FileHeader m_header = {};
+	uint64_t m_offset = 0;
+	uint64_t m_end = 0; // where the chunks end: at the index if there is one, else at the end of the file
+	bool m_complete = false;
+};
@@ -0,0 +1,37 @@
+#include "../OpenVR-SpaceCalibrator/CalibrationMetrics.h"
+
+#include <chrono>
+
+/*
+ * The metrics CalibrationCalc records into, for the replayer, which builds CalibrationCalc without the rest of
+ * the application. The series only need to hold the newest solve's values, so they keep no history.
+ */
+namespace Metrics {
+	double TimeSpan = 0, CurrentTime;
+
+	TimeSeries<Eigen::Vector3d> posOffset_rawComputed;
+	TimeSeries<Eigen::Vector3d> posOffset_currentCal;
+	TimeSeries<Eigen::Vector3d> posOffset_lastSample;
+	TimeSeries<Eigen::Vector3d> posOffset_byRelPose;
+
+	TimeSeries<double> error_rawComputed, error_currentCal, error_byRelPose, error_currentCalRelPose;
+	TimeSeries<double> axisIndependence;
+	TimeSeries<double> computationTime;
+	TimeSeries<double> rotationPairCount, pairingTime;
+
+	TimeSeries<bool> calibrationApplied;
+
+	bool enableLogs = false;
+
+	double timestamp() {
+		static const auto start = std::chrono::steady_clock::now();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void RecordTimestamp() {
+		CurrentTime = timestamp();
+	}
+
+	void WriteLogAnnotation(const char*) { }
+	void WriteLogEntry() { }
+}
@@ -0,0 +1,260 @@
+#include "Replayer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace {
+	// As Calibration.cpp turns the poses the driver published into samples.
+	Pose ConvertPose(const protocol::CompactPose &pose) {
+		Eigen::Quaterniond rot(pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3]);
+		rot.normalize(); // stored in single precision
+
+		return Pose(rot, Eigen::Vector3d(pose.position[0], pose.position[1], pose.position[2]));
+	}
+
+	IsoTransform ConvertIsoPose(const protocol::CompactPose &pose) {
+		Eigen::Quaterniond rot(pose.rotation[0], pose.rotation[1], pose.rotation[2], pose.rotation[3]);
+		return IsoTransform(rot, Eigen::Vector3d(pose.position[0], pose.position[1], pose.position[2]));
+	}
+
+	// The newest value of a series, if the solve just flushed recorded one; see Replayer::RunSolve.
+	double Fresh(const Metrics::TimeSeries<double> &series) {
+		if (series.size() > 0 && series.lastTs() == Metrics::CurrentTime) return series.last();
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+}
+
+Replayer::Settings::Settings() {
+	memset(&alignmentSpeedParams, 0, sizeof alignmentSpeedParams);
+
+	alignmentSpeedParams.thr_rot_tiny = 0.49f * (EIGEN_PI / 180.0f);
+	alignmentSpeedParams.thr_rot_small = 0.5f * (EIGEN_PI / 180.0f);
+	alignmentSpeedParams.thr_rot_large = 5.0f * (EIGEN_PI / 180.0f);
+
+	alignmentSpeedParams.thr_trans_tiny = 0.98f / 1000.0; // mm
+	alignmentSpeedParams.thr_trans_small = 1.0f / 1000.0; // mm
+	alignmentSpeedParams.thr_trans_large = 20.0f / 1000.0; // mm
+
+	alignmentSpeedParams.align_speed_tiny = 1.0f;
+	alignmentSpeedParams.align_speed_small = 1.0f;
+	alignmentSpeedParams.align_speed_large = 2.0f;
+}
+
+/*
+ * The calibration as the driver receives it from ScanAndApplyProfile: the profile's Euler angles in degrees and
+ * translation in cm, turned back into a rotation and a translation in metres.
+ */
+IsoTransform Replayer::DriverTarget(const Eigen::Vector3d &eulerdeg, const Eigen::Vector3d &transcm) {
+	const Eigen::Vector3d euler = eulerdeg * EIGEN_PI / 180.0;
+
+	const Eigen::Quaterniond rot =
+		Eigen::AngleAxisd(euler(0), Eigen::Vector3d::UnitZ()) *
+		Eigen::AngleAxisd(euler(1), Eigen::Vector3d::UnitY()) *
+		Eigen::AngleAxisd(euler(2), Eigen::Vector3d::UnitX());
+
+	return IsoTransform(rot, transcm * 0.01);
+}
+
+Replayer::Replayer(const Settings &settings, int64_t timestampFrequency, std::function<void(const Solve&)> onSolve)
+	: m_settings(settings), m_secondsPerTick(1.0 / (double)timestampFrequency), m_onSolve(onSolve) {
+	memset(m_latest, 0, sizeof m_latest);
+}
+
+void Replayer::Feed(const protocol::CompactPose &pose) {
+	if (!m_started) {
+		m_started = true;
+		m_firstSampleTime = m_now = pose.sampleTime;
+	}
+
+	// Several threads publish poses, so sample times are not quite in order; virtual time never goes back.
+	m_now = std::max<int64_t>(m_now, pose.sampleTime);
+	const double time = (m_now - m_firstSampleTime) * m_secondsPerTick;
+
+	// A tick only sees the poses published before it.
+	while (time >= m_nextTick) {
+		Tick(m_nextTick);
+		m_nextTick += m_settings.tickInterval;
+	}
+
+	if (pose.deviceId < vr::k_unMaxTrackedDeviceCount) {
+		m_latest[pose.deviceId] = pose;
+
+		if (pose.deviceId == m_settings.targetID) {
+			BlendPose(pose);
+		}
+	}
+
+	m_totals.poses++;
+	m_totals.virtualSeconds = time;
+}
+
+/*
+ * The part of CalibrationTick that runs during continuous calibration.
+ */
+void Replayer::Tick(double time) {
+	m_totals.ticks++;
+
+	// check for non-updating headset tracking space, and skip the tick if so
+	const double *p = m_latest[vr::k_unTrackedDeviceIndex_Hmd].position;
+	if ((p[0] == 0.0 && p[1] == 0.0 && p[2] == 0.0) || (m_xprev == p[0] && m_yprev == p[1] && m_zprev == p[2])) {
+		return;
+	}
+	m_xprev = (float)p[0];
+	m_yprev = (float)p[1];
+	m_zprev = (float)p[2];
+
+	if (m_settings.referenceID < 0 || m_settings.referenceID >= (int)vr::k_unMaxTrackedDeviceCount
+		|| m_settings.targetID < 0 || m_settings.targetID >= (int)vr::k_unMaxTrackedDeviceCount) {
+		return;
+	}
+
+	const protocol::CompactPose &reference = m_latest[m_settings.referenceID];
+	const protocol::CompactPose &target = m_latest[m_settings.targetID];
+	if (!reference.poseIsValid() || !target.poseIsValid()) {
+		return;
+	}
+
+	m_calc.SetWindowSize(m_settings.windowSize);
+	m_calc.pairSelection = m_settings.pairSelection;
+	m_calc.pairBudget = m_settings.pairBudget;
+	m_calc.PushSample(Sample(ConvertPose(reference), ConvertPose(target)));
+	m_totals.samples++;
+
+	if (m_calc.SampleCount() >= m_settings.windowSize) {
+		RunSolve(time);
+	}
+}
+
+/*
+ * What CalibrationWorker::Solve and ApplyCalibrationResult do with a full window.
+ */
+void Replayer::RunSolve(double time) {
+	m_calc.metrics.RecordTimestamp();
+	const double startTime = Metrics::timestamp();
+
+	bool lerp = false;
+	if (m_settings.continuous) {
+		m_calc.enableStaticRecalibration = m_settings.enableStaticRecalibration;
+		m_calc.lockRelativePosition = m_settings.lockRelativePosition;
+		m_calc.ComputeIncremental(lerp, m_settings.threshold);
+	}
+	else {
+		m_calc.enableStaticRecalibration = false;
+		m_calc.ComputeOneshot();
+	}
+
+	const double computeMs = (Metrics::timestamp() - startTime) * 1000.0;
+
+	Solve solve;
+	solve.time = time;
+	solve.samples = m_calc.SampleCount();
+	solve.valid = m_calc.isValid();
+	solve.computeMs = computeMs;
+	if (solve.valid) {
+		solve.translation = m_calc.Transformation().translation() * 100.0;
+		solve.rotation = m_calc.EulerRotation();
+	}
+
+	// Every sample flushed here carries the timestamp recorded above, which Flush leaves in CurrentTime; a series
+	// whose newest entry has an older timestamp was not recorded by this solve.
+	Metrics::CurrentTime = -1.0;
+	m_calc.metrics.Flush();
+	solve.errorRawComputed = Fresh(Metrics::error_rawComputed);
+	solve.errorCurrentCal = Fresh(Metrics::error_currentCal);
+	solve.errorByRelPose = Fresh(Metrics::error_byRelPose);
+	solve.axisIndependence = Fresh(Metrics::axisIndependence);
+	solve.pairingMs = Fresh(Metrics::pairingTime);
+	if (Metrics::calibrationApplied.size() > 0 && Metrics::calibrationApplied.lastTs() == Metrics::CurrentTime) {
+		solve.calibrationApplied = Metrics::calibrationApplied.last() ? 1 : 0;
+	}
+
+	solve.log.swap(m_calc.log);
+	m_calc.log.clear();
+
+	if (m_blended.enabled) {
+		const Eigen::Vector3d &position = m_blended.position;
+		solve.blendLagMm = ((m_blended.transform * position) - (m_blended.target * position)).norm() * 1000.0;
+		solve.blendLagDeg = m_blended.transform.rotation.angularDistance(m_blended.target.rotation) * 180.0 / EIGEN_PI;
+	}
+
+	if (solve.valid) {
+		SetTarget(DriverTarget(solve.rotation, solve.translation), m_settings.continuous);
+	}
+
+	m_totals.solves++;
+	if (solve.valid) m_totals.validSolves++;
+	m_totals.computeMs.push_back(computeMs);
+
+	if (m_onSolve) m_onSolve(solve);
+
+	if (m_settings.continuous) {
+		size_t drop_samples = m_settings.windowSize / 10;
+		for (size_t i = 0; i < drop_samples; i++) {
+			m_calc.ShiftSample();
+		}
+	}
+	else {
+		m_calc.Clear();
+	}
+}
+
+/*
+ * A new target for the target device, as the pose hook picks it up in UpdateTarget. Targets set without lerping,
+ * as one-shot calibrations are, move the active transform along with them.
+ */
+void Replayer::SetTarget(const IsoTransform &target, bool lerp) {
+	// The driver ignores targets that do not change anything; see WriteDeviceTransform.
+	if (m_blended.enabled && target.translation == m_blended.target.translation
+		&& target.rotation.coeffs() == m_blended.target.rotation.coeffs()) {
+		return;
+	}
+
+	m_blended.enabled = true;
+	m_blended.target = target;
+	if (!lerp) {
+		m_blended.transform = target;
+	}
+
+	// Blending resumes from now, rather than from the last pose that blended.
+	if (m_blended.converged) {
+		m_blended.lastPoll = m_now;
+	}
+	m_blended.converged = false;
+}
+
+/*
+ * The blending half of HandleDevicePoseUpdated, with the time since the last blend taken from sample times.
+ */
+void Replayer::BlendPose(const protocol::CompactPose &pose) {
+	if (!m_blended.enabled) return;
+
+	const IsoTransform deviceWorldPose = ConvertIsoPose(pose);
+	m_blended.position = deviceWorldPose.translation;
+
+	if (m_blended.converged) {
+		m_totals.convergedPoses++;
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	BlendedDevice &device = m_blended;
+	device.currentRate = blend::TransformDeltaSize(m_settings.alignmentSpeedParams, device.currentRate, deviceWorldPose, device.transform, device.target);
+
+	const double seconds = (pose.sampleTime - device.lastPoll) * m_secondsPerTick;
+	device.lastPoll = pose.sampleTime;
+
+	const double rate = blend::TransformRate(m_settings.alignmentSpeedParams, device.currentRate);
+	device.transform = blend::BlendTransform(device.transform, device.target, deviceWorldPose.translation, seconds, rate);
+
+	if (blend::HasConverged(device.transform, device.target)) {
+		device.transform = device.target;
+		device.currentRate = blend::TINY;
+		device.converged = true;
+	}
+
+	m_totals.blendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	m_totals.blendSteps++;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <openvr.h>
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "../OpenVR-SpaceCalibrator/CalibrationCalc.h"
+#include "../OpenVR-SpaceCalibratorDriver/TransformBlend.h"
+
+/*
+ * Runs the application's calibration loop, and the driver's blending of the target device towards each new
+ * calibration, on a stream of poses in virtual time, taken from the poses' own sample times. No OpenVR runtime
+ * and no threads are involved.
+ *
+ * Poses are fed in the order the driver published them. Every TickInterval of virtual time, the replayer does
+ * what CalibrationTick does: it pairs the newest reference and target poses into a sample, and solves whenever
+ * CalibrationWorker would, but synchronously. Each valid calibration becomes the target device's new target,
+ * which the device's later poses blend towards with the same steps as in the pose hook. The same poses always
+ * give the same calibrations; only the timings reported alongside them vary from run to run.
+ */
+class Replayer
+{
+public:
+	struct Settings
+	{
+		int referenceID = -1;
+		int targetID = -1;
+		double tickInterval = 0.05;
+
+		// As CalibrationTick sets them up for the worker.
+		size_t windowSize = CalibrationCalc::DefaultWindowSize;
+		CalibrationCalc::PairSelection pairSelection = CalibrationCalc::PairSelection::All;
+		size_t pairBudget = 64;
+		bool continuous = true;
+		bool enableStaticRecalibration = false;
+		bool lockRelativePosition = false;
+		double threshold = 1.5;
+
+		// Defaults as in CalibrationContext::ResetConfig.
+		protocol::AlignmentSpeedParams alignmentSpeedParams;
+
+		Settings();
+	};
+
+	/* The outcome of one solve of the sample window. */
+	struct Solve
+	{
+		double time = 0.0; // virtual seconds since the first pose
+		size_t samples = 0;
+		bool valid = false;
+		Eigen::Vector3d translation = Eigen::Vector3d::Zero(); // cm, as stored in the profile
+		Eigen::Vector3d rotation = Eigen::Vector3d::Zero(); // degrees, as CalibrationCalc::EulerRotation
+
+		// In mm, as recorded in the metrics; NaN where this solve did not compute them.
+		double errorRawComputed = 0.0, errorCurrentCal = 0.0, errorByRelPose = 0.0;
+		double axisIndependence = 0.0;
+		int calibrationApplied = -1; // 1 for a full calibration, 0 for a static one, -1 if neither
+
+		double computeMs = 0.0;
+		double pairingMs = 0.0;
+
+		// How far the target device's blended transform still was from its target, at the device's position.
+		double blendLagMm = 0.0, blendLagDeg = 0.0;
+
+		std::string log;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	struct Totals
+	{
+		uint64_t poses = 0;
+		uint64_t ticks = 0;
+		uint64_t samples = 0;
+		uint64_t solves = 0;
+		uint64_t validSolves = 0;
+		double virtualSeconds = 0.0;
+
+		std::vector<double> computeMs; // one per solve
+
+		uint64_t blendSteps = 0;
+		uint64_t convergedPoses = 0; // poses the pose hook would have passed through the converged path
+		double blendSeconds = 0.0;
+	};
+
+	Replayer(const Settings &settings, int64_t timestampFrequency, std::function<void(const Solve&)> onSolve);
+
+	void Feed(const protocol::CompactPose &pose);
+
+	const Totals& GetTotals() const { return m_totals; }
+
+	/* A solve's translation and rotation as the driver applies them, mapping target space into reference space. */
+	static IsoTransform DriverTarget(const Eigen::Vector3d &eulerdeg, const Eigen::Vector3d &transcm);
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	/* The pose hook's state for the target device, with lastPoll in sample time. */
+	struct BlendedDevice
+	{
+		bool enabled = false;
+		IsoTransform target;
+		IsoTransform transform;
+		blend::DeltaSize currentRate = blend::TINY;
+		bool converged = false;
+		int64_t lastPoll = 0;
+		Eigen::Vector3d position = Eigen::Vector3d::Zero();
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	Settings m_settings;
+	double m_secondsPerTick;
+	std::function<void(const Solve&)> m_onSolve;
+
+	CalibrationCalc m_calc;
+	BlendedDevice m_blended;
+
+	bool m_started = false;
+	int64_t m_firstSampleTime = 0, m_now = 0;
+	double m_nextTick = 0.0;
+
+	protocol::CompactPose m_latest[vr::k_unMaxTrackedDeviceCount];
+	float m_xprev = 0, m_yprev = 0, m_zprev = 0;
+
+	Totals m_totals;
+
+	void Tick(double time);
+	void RunSolve(double time);
+	void SetTarget(const IsoTransform &target, bool lerp);
+	void BlendPose(const protocol::CompactPose &pose);
+};
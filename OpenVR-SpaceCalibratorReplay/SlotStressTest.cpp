@@ -0,0 +1,113 @@
+#include "../OpenVR-SpaceCalibratorDriver/DeviceTransformSlot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+/*
+ * Stress test for the driver's SeqlockSlot: for a few seconds, one thread publishes targets as fast as it can, as
+ * the IPC thread and the transform table do, while several threads read them, as pose hooks do. Every field of a
+ * published target is derived from the same counter, so a read that mixes two publishes shows up as fields that
+ * disagree. Readers also check that they never see an older target after a newer one.
+ */
+
+namespace {
+	const int ReaderCount = 4;
+
+	DeviceTarget MakeTarget(uint32_t n) {
+		DeviceTarget target;
+		target.enabled = (n & 1) != 0;
+		target.quash = (n & 2) != 0;
+		target.transform.translation = Eigen::Vector3d(n, n + 1.0, n + 2.0);
+		target.transform.rotation = Eigen::Quaterniond(n, -(double)n, n * 0.5, n * 0.25);
+		target.scale = n * 2.0;
+		target.translationSnaps = n;
+		target.rotationSnaps = ~n;
+		return target;
+	}
+
+	bool Consistent(const DeviceTarget& target) {
+		const uint32_t n = target.translationSnaps;
+		const DeviceTarget expected = MakeTarget(n);
+		return target.enabled == expected.enabled
+			&& target.quash == expected.quash
+			&& target.transform.translation == expected.transform.translation
+			&& target.transform.rotation.coeffs() == expected.transform.rotation.coeffs()
+			&& target.scale == expected.scale
+			&& target.rotationSnaps == expected.rotationSnaps;
+	}
+
+	struct ReaderStats
+	{
+		uint64_t reads = 0, failed = 0, torn = 0, backwards = 0;
+	};
+}
+
+int main(int argc, char **argv)
+{
+	const double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+	DeviceTransformSlot *slot = new DeviceTransformSlot();
+	std::atomic<bool> done { false };
+	std::vector<ReaderStats> stats(ReaderCount);
+
+	std::vector<std::thread> readers;
+	for (int r = 0; r < ReaderCount; r++) {
+		readers.emplace_back([&, r] {
+			ReaderStats& s = stats[r];
+			DeviceTarget target;
+			uint32_t seen = 0, last = 0;
+			while (!done.load(std::memory_order_acquire)) {
+				if (!slot->Read(target, seen)) {
+					s.failed++;
+					std::this_thread::yield();
+					continue;
+				}
+				s.reads++;
+				if (!Consistent(target)) s.torn++;
+				if (target.translationSnaps < last) s.backwards++;
+				last = target.translationSnaps;
+			}
+		});
+	}
+
+	// Yield now and then, so that readers get preempted mid-copy even when there are fewer cores than threads.
+	const auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+	uint32_t publishes = 0;
+	while (std::chrono::steady_clock::now() < end) {
+		for (int i = 0; i < 64; i++) {
+			slot->Publish(MakeTarget(++publishes));
+		}
+		std::this_thread::yield();
+	}
+	done.store(true, std::memory_order_release);
+
+	for (auto& reader : readers) reader.join();
+
+	// A final read must see the last publish.
+	DeviceTarget target;
+	uint32_t seen = 0;
+	const bool final = slot->Read(target, seen) && target.translationSnaps == publishes && Consistent(target);
+	delete slot;
+
+	ReaderStats total;
+	for (const auto& s : stats) {
+		total.reads += s.reads;
+		total.failed += s.failed;
+		total.torn += s.torn;
+		total.backwards += s.backwards;
+	}
+
+	printf("%u publishes, %d readers: %llu reads, %llu empty or raced, %llu torn, %llu out of order\n",
+		publishes, ReaderCount, (unsigned long long)total.reads, (unsigned long long)total.failed,
+		(unsigned long long)total.torn, (unsigned long long)total.backwards);
+
+	if (total.torn || total.backwards || !final) {
+		fprintf(stderr, "FAILED%s\n", final ? "" : ": the last publish was not read back");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include "SyntheticPoses.h"
+#include "Replayer.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+	const double Degrees = EIGEN_PI / 180.0;
+
+	Eigen::Quaterniond YawPitchRoll(double yaw, double pitch, double roll) {
+		return Eigen::Quaterniond(
+			Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitY()) *
+			Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitX()) *
+			Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitZ()));
+	}
+
+	// Both devices waved around in front of the user, about a metre up; one loop takes about four seconds.
+	IsoTransform FigureEight(double s) {
+		const Eigen::Vector3d position(0.35 * sin(1.6 * s), 1.2 + 0.2 * sin(3.2 * s), -0.4 + 0.1 * sin(0.8 * s));
+		const Eigen::Quaterniond rotation = YawPitchRoll(
+			60.0 * Degrees * sin(0.7 * s),
+			45.0 * Degrees * sin(1.1 * s + 0.5),
+			35.0 * Degrees * sin(1.3 * s + 1.0));
+		return IsoTransform(rotation, position);
+	}
+
+	// A headset walked around a 3 by 2 metre ellipse at about a metre a second, facing where it goes but looking
+	// around a little, with a step's bob and sway.
+	IsoTransform Walking(double s) {
+		const double theta = s / 1.25;
+		const double step = 2.0 * EIGEN_PI * 2.0 * s;
+
+		const Eigen::Vector3d position(1.5 * cos(theta), 1.7 + 0.03 * sin(step), 1.0 * sin(theta));
+
+		// OpenVR devices face -z.
+		const double dx = -1.5 * sin(theta), dz = 1.0 * cos(theta);
+		const double heading = atan2(-dx, -dz);
+
+		const Eigen::Quaterniond rotation = YawPitchRoll(
+			heading + 30.0 * Degrees * sin(0.4 * s),
+			10.0 * Degrees * sin(0.3 * s),
+			3.0 * Degrees * sin(0.5 * step));
+		return IsoTransform(rotation, position);
+	}
+
+	// A seated user looking left and right. The headset turns about the neck, so it moves a little as it turns,
+	// but nearly all of the rotation is about the vertical axis.
+	IsoTransform HeadYaw(double s) {
+		const Eigen::Vector3d neck(0.02 * sin(0.5 * s), 1.1 + 0.01 * sin(0.3 * s), 0.02 * sin(0.4 * s));
+		const Eigen::Quaterniond rotation = YawPitchRoll(
+			80.0 * Degrees * sin(0.6 * s),
+			5.0 * Degrees * sin(0.35 * s),
+			0.0);
+		return IsoTransform(rotation, neck + rotation * Eigen::Vector3d(0.0, 0.1, -0.08));
+	}
+}
+
+SyntheticPoses::SyntheticPoses(const Settings &settings)
+	: m_settings(settings), m_random(settings.seed) {
+	m_truth = Replayer::DriverTarget(settings.truthRotation, settings.truthTranslation);
+	m_offset = Replayer::DriverTarget(settings.offsetRotation, settings.offsetTranslation);
+	NextDropout(0.0);
+}
+
+IsoTransform SyntheticPoses::Truth(double t) const {
+	const double minutes = t / 60.0;
+
+	IsoTransform truth = m_truth;
+	truth.rotation = Eigen::AngleAxisd(m_settings.driftYaw * minutes * Degrees, Eigen::Vector3d::UnitY()) * truth.rotation;
+	truth.pretranslate(m_settings.driftTranslation * 0.001 * minutes);
+	return truth;
+}
+
+IsoTransform SyntheticPoses::ReferencePose(double t) const {
+	const double s = t * m_settings.speed;
+	switch (m_settings.trajectory) {
+	case Trajectory::Walking: return Walking(s);
+	case Trajectory::HeadYaw: return HeadYaw(s);
+	default: return FigureEight(s);
+	}
+}
+
+IsoTransform SyntheticPoses::TargetPose(double t) const {
+	return ReferencePose(t) * m_offset;
+}
+
+bool SyntheticPoses::Next(protocol::CompactPose &pose) {
+	const double referenceTime = m_referenceCount / m_settings.referenceRate;
+	const double targetTime = m_targetCount / m_settings.targetRate;
+
+	if (referenceTime <= targetTime) {
+		if (referenceTime > m_settings.duration) return false;
+
+		pose = MakePose(ReferenceID, referenceTime, ReferencePose(referenceTime), true);
+		m_referenceCount++;
+		return true;
+	}
+
+	if (targetTime > m_settings.duration) return false;
+
+	while (targetTime >= m_dropoutStart + m_settings.dropoutLength) {
+		NextDropout(m_dropoutStart + m_settings.dropoutLength);
+	}
+	const bool valid = targetTime < m_dropoutStart;
+
+	// The target reports where it was latencySkew ago, in its own tracking space.
+	const IsoTransform tracked = TargetPose(targetTime - m_settings.latencySkew * 0.001);
+	pose = MakePose(TargetID, targetTime, Truth(targetTime).inverse() * tracked, valid);
+	m_targetCount++;
+	return true;
+}
+
+/*
+ * Dropouts start at exponentially distributed intervals, so they arrive at the configured rate on average.
+ */
+void SyntheticPoses::NextDropout(double after) {
+	if (!(m_settings.dropoutsPerMinute > 0.0)) {
+		m_dropoutStart = std::numeric_limits<double>::infinity();
+		return;
+	}
+
+	std::exponential_distribution<double> interval(m_settings.dropoutsPerMinute / 60.0);
+	m_dropoutStart = after + interval(m_random);
+}
+
+protocol::CompactPose SyntheticPoses::MakePose(int deviceId, double t, const IsoTransform &pose, bool valid) {
+	Eigen::Vector3d position = pose.translation;
+	Eigen::Quaterniond rotation = pose.rotation;
+
+	if (m_settings.positionNoise > 0.0) {
+		const double sigma = m_settings.positionNoise * 0.001;
+		position += Eigen::Vector3d(m_normal(m_random), m_normal(m_random), m_normal(m_random)) * sigma;
+	}
+	if (m_settings.rotationNoise > 0.0) {
+		const Eigen::Vector3d axis = Eigen::Vector3d(m_normal(m_random), m_normal(m_random), m_normal(m_random)) * (m_settings.rotationNoise * Degrees);
+		if (axis.norm() > 0.0) {
+			rotation = Eigen::AngleAxisd(axis.norm(), axis.normalized()) * rotation;
+		}
+	}
+
+	protocol::CompactPose out;
+	memset(&out, 0, sizeof out);
+	out.sampleTime = (int64_t)llround(t * TimestampFrequency);
+	out.position[0] = position(0);
+	out.position[1] = position(1);
+	out.position[2] = position(2);
+	out.rotation[0] = (float)rotation.w();
+	out.rotation[1] = (float)rotation.x();
+	out.rotation[2] = (float)rotation.y();
+	out.rotation[3] = (float)rotation.z();
+	out.deviceId = (uint16_t)deviceId;
+	out.result = valid ? vr::TrackingResult_Running_OK : vr::TrackingResult_Running_OutOfRange;
+	out.flags = protocol::CompactPose::DeviceIsConnected | (valid ? protocol::CompactPose::PoseIsValid : 0);
+	return out;
+}
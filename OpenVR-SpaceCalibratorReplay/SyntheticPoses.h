@@ -0,0 +1,102 @@
+#pragma once
+
+#include <openvr.h>
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <random>
+
+#include "../Protocol.h"
+#include "../OpenVR-SpaceCalibratorDriver/IsometryTransform.h"
+
+/*
+ * Generates the pose stream of a reference device and a target device that are rigidly attached to each other,
+ * as a tracker strapped to a headset is, but tracked in two different tracking spaces. The target's tracking
+ * space is related to the reference's by a known transform, the ground truth a calibration should find, which
+ * may drift slowly over time as inside-out tracking does.
+ *
+ * The poses come out in sample time order, in the same form the driver publishes them, so they can be fed to a
+ * Replayer exactly as a recording would be.
+ */
+class SyntheticPoses
+{
+public:
+	enum class Trajectory
+	{
+		FigureEight, // the devices held in one hand and waved in a figure eight, turning on every axis
+		Walking,     // a headset walked around a room, turning mostly about the vertical axis
+		HeadYaw,     // a seated headset looking left and right, with little else to go on
+	};
+
+	struct Settings
+	{
+		Trajectory trajectory = Trajectory::FigureEight;
+		double duration = 60.0; // seconds
+		double speed = 1.0;     // scales how fast the trajectory is traced
+
+		// The transform from the target's tracking space into the reference's, as stored in a profile.
+		Eigen::Vector3d truthTranslation = Eigen::Vector3d(30.0, -10.0, 50.0); // cm
+		Eigen::Vector3d truthRotation = Eigen::Vector3d(0.0, 40.0, 0.0);       // degrees about z, y and x, as CalibrationCalc::EulerRotation
+
+		// How fast the ground truth moves away from the above.
+		Eigen::Vector3d driftTranslation = Eigen::Vector3d::Zero(); // mm per minute
+		double driftYaw = 0.0;                                      // degrees per minute, about the vertical axis
+
+		// Where the target device sits on the reference device, in the reference device's frame.
+		Eigen::Vector3d offsetTranslation = Eigen::Vector3d(5.0, 2.0, -3.0); // cm
+		Eigen::Vector3d offsetRotation = Eigen::Vector3d(10.0, 20.0, 5.0);   // degrees about z, y and x
+
+		// Gaussian noise added to every pose of both devices, as a standard deviation.
+		double positionNoise = 0.0; // mm
+		double rotationNoise = 0.0; // degrees
+
+		// Times the target device loses tracking, and reports invalid poses.
+		double dropoutsPerMinute = 0.0;
+		double dropoutLength = 0.5; // seconds
+
+		// How much older the target's poses are than their sample times claim, relative to the reference's.
+		double latencySkew = 0.0; // ms
+
+		double referenceRate = 250.0; // Hz
+		double targetRate = 250.0;    // Hz
+
+		uint32_t seed = 1;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	/* Sample times are in nanoseconds. */
+	static const int64_t TimestampFrequency = 1000000000;
+
+	/* The reference device is the headset, which the calibration tick checks for a frozen tracking space. */
+	static const int ReferenceID = vr::k_unTrackedDeviceIndex_Hmd;
+	static const int TargetID = 1;
+
+	explicit SyntheticPoses(const Settings &settings);
+
+	/* Produces the next pose, in sample time order. Returns false once the duration has been generated. */
+	bool Next(protocol::CompactPose &pose);
+
+	/* The ground truth at time t, in seconds since the first pose: target tracking space to reference. */
+	IsoTransform Truth(double t) const;
+
+	/* Where the two devices really are at time t, in the reference's tracking space. */
+	IsoTransform ReferencePose(double t) const;
+	IsoTransform TargetPose(double t) const;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	Settings m_settings;
+	IsoTransform m_truth;
+	IsoTransform m_offset;
+
+	std::mt19937 m_random;
+	std::normal_distribution<double> m_normal;
+
+	uint64_t m_referenceCount = 0, m_targetCount = 0;
+	double m_dropoutStart = 0.0;
+
+	void NextDropout(double after);
+	protocol::CompactPose MakePose(int deviceId, double t, const IsoTransform &pose, bool valid);
+};
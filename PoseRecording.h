@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Protocol.h"
+
+/**
+ * File format of pose recordings: the CompactPose records the driver published, as the application read them
+ * from the pose ring, so that what a user's rig produced can be replayed offline.
+ *
+ * A recording starts with a FileHeader, followed by chunks. Each chunk is a ChunkHeader and then its poses, as
+ * raw CompactPose records in the order the driver wrote them. The file is only ever appended to; when the
+ * recording is closed, an index of all chunks (one IndexEntry each) and a Trailer pointing at it are appended
+ * last. A recording that was cut short has no trailer, but can still be read by walking the chunk headers.
+ *
+ * All fields are little-endian, and the layout of CompactPose is the one named by compactPoseVersion.
+ */
+namespace recording
+{
+	const char FileMagic[8] = { 'S', 'C', 'P', 'O', 'S', 'E', 'S', '\0' };
+	const uint32_t FormatVersion = 1;
+	const uint32_t ChunkMagic = 0x4b4e4843; // "CHNK"
+	const uint32_t TrailerMagic = 0x58444e49; // "INDX"
+
+	static_assert(sizeof(protocol::CompactPose) == 56, "Recordings store CompactPose records as they are laid out in memory");
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t formatVersion;
+		uint32_t compactPoseVersion;
+
+		// Units of CompactPose::sampleTime per second.
+		int64_t timestampFrequency;
+
+		// Milliseconds since the Unix epoch when the recording started, and the sample time at that moment.
+		int64_t startUnixTimeMs;
+		int64_t startSampleTime;
+
+		uint64_t reserved[3];
+	};
+	static_assert(sizeof(FileHeader) == 64, "FileHeader layout is part of the file format");
+
+	struct ChunkHeader
+	{
+		uint32_t magic;
+		uint32_t poseCount;
+		int64_t firstSampleTime;
+		int64_t lastSampleTime;
+
+		// Poses the recorder knows it lost between the previous chunk and this one.
+		uint64_t droppedPoses;
+	};
+	static_assert(sizeof(ChunkHeader) == 32, "ChunkHeader layout is part of the file format");
+
+	struct IndexEntry
+	{
+		// File offset of the chunk's header.
+		uint64_t offset;
+		int64_t firstSampleTime;
+		int64_t lastSampleTime;
+		uint32_t poseCount;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(IndexEntry) == 32, "IndexEntry layout is part of the file format");
+
+	struct Trailer
+	{
+		uint64_t indexOffset;
+		uint32_t chunkCount;
+		uint32_t magic;
+	};
+	static_assert(sizeof(Trailer) == 16, "Trailer layout is part of the file format");
+}
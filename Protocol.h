@@ -1,17 +1,39 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <atomic>
 #include <stdexcept>
 #include <functional>
+#include <string>
 
 #ifndef _OPENVR_API
 #include <openvr_driver.h>
 #endif
 
 #define OPENVR_SPACECALIBRATOR_PIPE_NAME "\\\\.\\pipe\\OpenVRSpaceCalibratorDriver"
-#define OPENVR_SPACECALIBRATOR_SHMEM_NAME "OpenVRSpaceCalibratorPoseMemoryV1"
+#define OPENVR_SPACECALIBRATOR_SHMEM_NAME "OpenVRSpaceCalibratorPoseMemoryV5"
+#define OPENVR_SPACECALIBRATOR_CONTROL_SHMEM_NAME "OpenVRSpaceCalibratorControlMemoryV1"
+#define OPENVR_SPACECALIBRATOR_STATS_SHMEM_NAME "OpenVRSpaceCalibratorStatsMemoryV1"
 
 #ifdef _OPENVR_API 
 
@@ -92,7 +114,7 @@ namespace vr {
 
 namespace protocol
 {
-	const uint32_t Version = 4;
+	const uint32_t Version = 8;
 
 	enum RequestType
 	{
@@ -100,7 +122,8 @@ namespace protocol
 		RequestHandshake,
 		RequestSetDeviceTransform,
 		RequestSetAlignmentSpeedParams,
-		RequestDebugOffset
+		RequestDebugOffset,
+		RequestSetDeviceTransforms
 	};
 
 	enum ResponseType
@@ -151,6 +174,8 @@ namespace protocol
 		bool lerp;
 		bool quash;
 
+		SetDeviceTransform() : SetDeviceTransform(0, false) { }
+
 		SetDeviceTransform(uint32_t id, bool enabled) :
 			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(false), updateScale(false), lerp(false), quash(false) { }
 
@@ -170,121 +195,178 @@ namespace protocol
 			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(true), updateScale(true), translation(translation), rotation(rotation), scale(scale), lerp(false), quash(false) { }
 	};
 
+	/**
+	 * The alignment speed parameters together with the transforms of any number of devices, which the driver
+	 * applies in one go. Only the first `count` entries of `transforms` are sent over the pipe.
+	 */
+	struct SetDeviceTransforms
+	{
+		AlignmentSpeedParams alignmentSpeedParams;
+		uint32_t count;
+		SetDeviceTransform transforms[vr::k_unMaxTrackedDeviceCount];
+
+		void Add(const SetDeviceTransform& transform) {
+			if (count < vr::k_unMaxTrackedDeviceCount) transforms[count++] = transform;
+		}
+	};
+
 	struct Request
 	{
 		RequestType type;
 
+		/** Chosen by the client and echoed back in the response, so that several requests can be in flight. */
+		uint32_t requestId;
+
 		union {
 			SetDeviceTransform setDeviceTransform;
 			AlignmentSpeedParams setAlignmentSpeedParams;
+			SetDeviceTransforms setDeviceTransforms;
 		};
 
-		Request() : type(RequestInvalid) { }
-		Request(RequestType type) : type(type) { }
-		Request(AlignmentSpeedParams params) : type(RequestType::RequestSetAlignmentSpeedParams), setAlignmentSpeedParams(params) {}
+		Request() : type(RequestInvalid), requestId(0) { }
+		Request(RequestType type) : type(type), requestId(0) { }
+		Request(AlignmentSpeedParams params) : type(RequestType::RequestSetAlignmentSpeedParams), requestId(0), setAlignmentSpeedParams(params) {}
 	};
 
+	/**
+	 * Number of leading bytes of `request` that carry its payload, which is all the client writes to the pipe.
+	 * Keeps small requests small now that the union holds a whole device table.
+	 */
+	inline size_t RequestSize(const Request& request)
+	{
+		const size_t header = offsetof(Request, setDeviceTransform);
+
+		switch (request.type)
+		{
+		case RequestHandshake:
+		case RequestDebugOffset:
+			return header;
+		case RequestSetDeviceTransform:
+			return header + sizeof(SetDeviceTransform);
+		case RequestSetAlignmentSpeedParams:
+			return header + sizeof(AlignmentSpeedParams);
+		case RequestSetDeviceTransforms:
+			return header + offsetof(SetDeviceTransforms, transforms)
+				+ std::min<uint32_t>(request.setDeviceTransforms.count, vr::k_unMaxTrackedDeviceCount) * sizeof(SetDeviceTransform);
+		default:
+			return sizeof(Request);
+		}
+	}
+
 	struct Response
 	{
 		ResponseType type;
+		uint32_t requestId;
 
 		union {
 			Protocol protocol;
 		};
 
-		Response() : type(ResponseInvalid) { }
-		Response(ResponseType type) : type(type) { }
+		Response() : type(ResponseInvalid), requestId(0) { }
+		Response(ResponseType type) : type(type), requestId(0) { }
 	};
 
-	class DriverPoseShmem {
-	public:
-		struct AugmentedPose {
-			LARGE_INTEGER sample_time;
-			int deviceId;
-			vr::DriverPose_t pose;
-		};
-	private:
-		static const uint32_t SYNC_ACTIVE_POSE_B = 0x80000000;
-		static const uint32_t BUFFERED_SAMPLES = 64 * 1024;
+	/**
+	 * Compact pose record published through the pose shared memory. The pose is already in world space, that is,
+	 * composed with the driver's qWorldFromDriverRotation/vecWorldFromDriverTranslation, and the rest of
+	 * vr::DriverPose_t is left out, so that a record and its sequence counter share a single cache line.
+	 * The layout is versioned by CompactPoseVersion; the writer stores it in the segment header.
+	 */
+	const uint32_t CompactPoseVersion = 1;
 
-		struct ShmemData {
-			std::atomic<uint64_t> index;
-			AugmentedPose poses[BUFFERED_SAMPLES];
+	struct CompactPose
+	{
+		enum Flags : uint8_t
+		{
+			PoseIsValid = 1 << 0,
+			DeviceIsConnected = 1 << 1,
 		};
-		
-	private:
-		HANDLE hMapFile;
-		ShmemData* pData;
-		uint64_t cursor;
 
-		AugmentedPose lastPose[vr::k_unMaxTrackedDeviceCount];
+		// QueryPerformanceCounter ticks on Windows, CLOCK_MONOTONIC nanoseconds elsewhere.
+		int64_t sampleTime;
+		double position[3];
+		float rotation[4]; // w, x, y, z
+		uint16_t deviceId;
+		uint8_t result; // vr::ETrackingResult
+		uint8_t flags;
 
-		std::string LastErrorString(DWORD lastError)
-		{
-			LPSTR buffer = nullptr;
-			size_t size = FormatMessageA(
-				FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-				NULL, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&buffer, 0, NULL
-			);
-
-			std::string message(buffer, size);
-			LocalFree(buffer);
-			return message;
-		}
+		bool poseIsValid() const { return (flags & PoseIsValid) != 0; }
+		bool deviceIsConnected() const { return (flags & DeviceIsConnected) != 0; }
+	};
+	static_assert(sizeof(CompactPose) <= 56, "CompactPose must fit a cache line together with its sequence counter");
 
+	/**
+	 * A named shared memory segment of a fixed size, mapped for reading and writing: a file mapping on Windows,
+	 * shm_open and mmap elsewhere. A segment that Create has to make from scratch starts out zero-filled.
+	 */
+	class SharedSegment {
 	public:
-		operator bool() const {
-			return pData != nullptr;
-		}
+		SharedSegment() { }
+		SharedSegment(const SharedSegment&) = delete;
+		SharedSegment& operator=(const SharedSegment&) = delete;
 
-		bool operator!() const {
-			return pData == nullptr;
+		~SharedSegment() {
+			Close();
 		}
 
-		DriverPoseShmem() {
-			hMapFile = INVALID_HANDLE_VALUE;
-			pData = nullptr;
-			cursor = 0;
-		}
-
-		~DriverPoseShmem() {
-			Close();
+		void* Data() const {
+			return data;
 		}
 
 		void Close() {
-			if (pData) UnmapViewOfFile(pData);
+#ifdef _WIN32
+			if (data) UnmapViewOfFile(data);
 			if (hMapFile) CloseHandle(hMapFile);
+			hMapFile = NULL;
+#else
+			if (data) munmap(data, size);
+			if (shmFd >= 0) close(shmFd);
+			shmFd = -1;
+#endif
+			data = nullptr;
 		}
 
-		bool Create(LPCSTR segment_name) {
+		bool Create(const char* segment_name, size_t segment_size) {
 			Close();
+			size = segment_size;
 
+#ifdef _WIN32
 			hMapFile = CreateFileMappingA(
 				INVALID_HANDLE_VALUE,
 				NULL,
 				PAGE_READWRITE,
-				0,
-				sizeof(ShmemData),
+				(DWORD)((uint64_t)size >> 32),
+				(DWORD)size,
 				segment_name
 			);
 
 			if (!hMapFile) return false;
 
-			pData = reinterpret_cast<ShmemData*>(MapViewOfFile(
+			data = MapViewOfFile(
 				hMapFile,
 				FILE_MAP_ALL_ACCESS,
 				0,
 				0,
-				sizeof(ShmemData)
-			));
+				size
+			);
+#else
+			shmFd = shm_open(PosixSegmentName(segment_name).c_str(), O_CREAT | O_RDWR, 0600);
+			if (shmFd < 0) return false;
 
-			return !!pData;
-		}
+			if (ftruncate(shmFd, size) != 0) return false;
 
+			MapPosix();
+#endif
 
-		void Open(LPCSTR segment_name) {
+			return data != nullptr;
+		}
+
+		/* Opens a segment made by Create. `description` names the segment in the error thrown if that fails. */
+		void Open(const char* segment_name, size_t segment_size, const char* description) {
 			Close();
+			size = segment_size;
 
+#ifdef _WIN32
 			hMapFile = OpenFileMappingA(
 				FILE_MAP_ALL_ACCESS,
 				FALSE,
@@ -292,71 +374,972 @@ namespace protocol
 			);
 
 			if (!hMapFile) {
-				throw std::runtime_error("Failed to open pose data shared memory segment: " + LastErrorString(GetLastError()));
+				throw std::runtime_error(std::string("Failed to open ") + description + " shared memory segment: " + LastErrorString(GetLastError()));
 			}
 
-			pData = reinterpret_cast<ShmemData*>(MapViewOfFile(
+			data = MapViewOfFile(
 				hMapFile,
 				FILE_MAP_ALL_ACCESS,
 				0,
 				0,
-				sizeof(ShmemData)
-			));
+				size
+			);
 
-			if (!pData) {
-				throw std::runtime_error("Failed to map pose data shared memory segment: " + LastErrorString(GetLastError()));
+			if (!data) {
+				throw std::runtime_error(std::string("Failed to map ") + description + " shared memory segment: " + LastErrorString(GetLastError()));
 			}
 
 			char tmp[256];
-			snprintf(tmp, sizeof tmp, "Opened shmem segment: %p\n", pData);
+			snprintf(tmp, sizeof tmp, "Opened shmem segment: %p\n", data);
 			OutputDebugStringA(tmp);
+#else
+			shmFd = shm_open(PosixSegmentName(segment_name).c_str(), O_RDWR, 0);
+			if (shmFd < 0) {
+				throw std::runtime_error(std::string("Failed to open ") + description + " shared memory segment: " + LastErrorString(errno));
+			}
+
+			if (!MapPosix()) {
+				throw std::runtime_error(std::string("Failed to map ") + description + " shared memory segment: " + LastErrorString(errno));
+			}
+#endif
 		}
 
-		void ReadNewPoses(std::function<void(AugmentedPose const&)> cb) {
-			if (!pData) throw std::runtime_error("Not open");
-			
-			uint64_t cur_index = pData->index.load(std::memory_order_acquire);
-			if (cur_index < cursor || cur_index - cursor > BUFFERED_SAMPLES / 2) {
-				if (cur_index < BUFFERED_SAMPLES / 2)
-					cursor = cur_index;
-				else
-					cursor = cur_index - BUFFERED_SAMPLES / 2;
+		/**
+		 * Removes a segment created by Create from the system namespace. Mappings that are still open stay valid.
+		 * Windows removes the segment by itself once the last handle is closed, so this only matters for POSIX.
+		 */
+		static void Unlink(const char* segment_name) {
+#ifndef _WIN32
+			shm_unlink(PosixSegmentName(segment_name).c_str());
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE hMapFile = NULL;
+#else
+		int shmFd = -1;
+#endif
+		void* data = nullptr;
+		size_t size = 0;
+
+#ifdef _WIN32
+		static std::string LastErrorString(DWORD lastError)
+		{
+			LPSTR buffer = nullptr;
+			size_t size = FormatMessageA(
+				FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+				NULL, lastError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&buffer, 0, NULL
+			);
+
+			std::string message(buffer, size);
+			LocalFree(buffer);
+			return message;
+		}
+#else
+		static std::string LastErrorString(int lastError)
+		{
+			return std::string(strerror(lastError));
+		}
+
+		static std::string PosixSegmentName(const char* segment_name)
+		{
+			return std::string("/") + segment_name;
+		}
+
+		bool MapPosix() {
+			void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+			if (addr == MAP_FAILED) return false;
+
+			data = addr;
+			return true;
+		}
+#endif
+	};
+
+	/**
+	 * Ring buffer of device poses in shared memory, written by the driver and read by the application.
+	 *
+	 * Each slot carries a sequence counter (a seqlock): while entry n is being written the slot holds 2n + 1,
+	 * and 2n once it is complete. A reader checks the counter before and after copying a slot, so a pose that
+	 * was overwritten while it was being read (the writer lapped the reader) is detected and skipped instead of
+	 * being delivered torn. Writers claim entries with an atomic increment, so several driver threads may write
+	 * concurrently; a writer that finds its slot still held by another one (which can only happen once the ring
+	 * has wrapped around during a single write) drops its pose rather than mixing the two. Slots are aligned to
+	 * cache lines so that neighbouring writers do not share a line.
+	 *
+	 * The header also holds, for every device, the entry of its newest pose, which writers advance after each
+	 * write. GetLatestPose uses it to fetch the current pose of one device without replaying the ring.
+	 *
+	 * Poses are published as CompactPose records. Readers that need the full vr::DriverPose_t can opt in with
+	 * SetFullPosesEnabled, which takes a lease that the reader keeps renewing; while any lease is current, the driver
+	 * also writes every pose to a second, smaller ring of AugmentedPose records, which is read with ReadNewFullPoses.
+	 * A reader that goes away without giving its lease back only costs the driver the extra writes until it lapses.
+	 *
+	 * Readers that would otherwise poll the ring can block in WaitForNewPoses instead. Writers signal a named
+	 * event on Windows, or wake a futex on the header's notification sequence on Linux, but only while someone
+	 * is waiting, and at most once per millisecond.
+	 */
+	class DriverPoseShmem {
+	public:
+		struct AugmentedPose {
+			// QueryPerformanceCounter ticks on Windows, CLOCK_MONOTONIC nanoseconds elsewhere.
+			int64_t sample_time;
+			int deviceId;
+			vr::DriverPose_t pose;
+		};
+	private:
+		static const uint32_t BUFFERED_SAMPLES = 64 * 1024;
+		static const uint32_t BUFFERED_FULL_SAMPLES = 4 * 1024;
+		// How long a full pose lease lasts unless renewed, and how much of it may be left before it is.
+		static const int64_t FULL_POSE_LEASE_MS = 2000;
+		static const int64_t FULL_POSE_RENEW_MS = 1000;
+		// Reads of a slot that is still being written are retried this many times before the reader gives up for now.
+		static const int WRITE_IN_PROGRESS_RETRIES = 16;
+
+		template<typename T>
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> sequence;
+			T pose;
+		};
+		static_assert(sizeof(Slot<CompactPose>) == 64, "Compact pose slots should be exactly one cache line");
+
+		/* A ring of slots in the segment. Entry n lives in slot n % Count; index is the last entry claimed by a writer. */
+		template<typename T, uint32_t Count>
+		struct Ring {
+			static const uint32_t Size = Count;
+
+			alignas(64) std::atomic<uint64_t> index;
+			Slot<T> slots[Count];
+		};
+
+		struct ShmemData {
+			uint32_t compactPoseVersion;
+			// Timestamp until which the driver also writes full poses; readers that want them keep moving it forward.
+			std::atomic<int64_t> fullPoseLease;
+
+			// Readers blocked in WaitForNewPoses, the futex word they sleep on, and the time of the last wakeup.
+			std::atomic<uint32_t> notifyWaiters;
+			std::atomic<uint32_t> notifySequence;
+			std::atomic<int64_t> lastNotifyTime;
+
+			// Entry in `poses` of each device's newest pose, or 0 if it has none yet.
+			alignas(64) std::atomic<uint64_t> latestEntry[vr::k_unMaxTrackedDeviceCount];
+
+			Ring<CompactPose, BUFFERED_SAMPLES> poses;
+			Ring<AugmentedPose, BUFFERED_FULL_SAMPLES> fullPoses;
+		};
+
+		/* Read position of one reader in one ring. */
+		struct Cursor {
+			uint64_t entry = 0; // last entry consumed
+			uint64_t stalledEntry = 0;
+		};
+
+		enum ReadResult {
+			ReadOk,
+			ReadNotWritten,
+			ReadOverwritten
+		};
+
+	private:
+		SharedSegment segment;
+#ifdef _WIN32
+		HANDLE hNewPoseEvent;
+#endif
+		ShmemData* pData;
+		Cursor cursor, fullCursor;
+		uint64_t skippedPoses;
+		bool fullPosesEnabled;
+		int64_t fullPoseLease; // the lease this reader last took
+
+		static int64_t Timestamp() {
+#ifdef _WIN32
+			LARGE_INTEGER ts;
+			QueryPerformanceCounter(&ts);
+			return ts.QuadPart;
+#else
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+		}
+
+		static int64_t TimestampsPerMillisecond() {
+#ifdef _WIN32
+			static const int64_t perMillisecond = [] {
+				LARGE_INTEGER freq;
+				QueryPerformanceFrequency(&freq);
+				return freq.QuadPart / 1000;
+			}();
+			return perMillisecond;
+#else
+			return 1000000;
+#endif
+		}
+
+		/* Moves the shared full pose lease to FULL_POSE_LEASE_MS from now, once ours gets within FULL_POSE_RENEW_MS of running out. */
+		void RenewFullPoseLease() {
+			const int64_t now = Timestamp();
+			// Several readers may hold leases; the shared one is the longest, or 0 if a reader gave it back.
+			if (fullPoseLease - now > FULL_POSE_RENEW_MS * TimestampsPerMillisecond()
+				&& pData->fullPoseLease.load(std::memory_order_relaxed) >= fullPoseLease) return;
+
+			fullPoseLease = now + FULL_POSE_LEASE_MS * TimestampsPerMillisecond();
+			int64_t current = pData->fullPoseLease.load(std::memory_order_relaxed);
+			while (current < fullPoseLease && !pData->fullPoseLease.compare_exchange_weak(current, fullPoseLease, std::memory_order_relaxed)) { }
+		}
+
+#ifdef _WIN32
+		static std::string NewPoseEventName(const char* segment_name) {
+			return std::string(segment_name) + "NewPoses";
+		}
+#elif defined(__linux__)
+		long Futex(int op, uint32_t value, const timespec* timeout) const {
+			// Not FUTEX_PRIVATE_FLAG: the word is shared with other processes.
+			return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&pData->notifySequence), op, value, timeout, nullptr, 0);
+		}
+#endif
+
+		/**
+		 * Wakes readers blocked in WaitForNewPoses, unless none are waiting or another write already woke them less
+		 * than a millisecond ago. Must follow the ring write it announces.
+		 */
+		void NotifyNewPoses(int64_t sampleTime) {
+			// Pairs with the fence in WaitForNewPoses: either we see the waiter, or it sees our write.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (pData->notifyWaiters.load(std::memory_order_relaxed) == 0) return;
+
+			int64_t last = pData->lastNotifyTime.load(std::memory_order_relaxed);
+			if (sampleTime - last < TimestampsPerMillisecond()) return;
+			if (!pData->lastNotifyTime.compare_exchange_strong(last, sampleTime, std::memory_order_relaxed)) return;
+
+			pData->notifySequence.fetch_add(1, std::memory_order_relaxed);
+#ifdef _WIN32
+			if (hNewPoseEvent) SetEvent(hNewPoseEvent);
+#elif defined(__linux__)
+			Futex(FUTEX_WAKE, INT32_MAX, nullptr);
+#endif
+		}
+
+		static vr::HmdQuaternion_t Multiply(const vr::HmdQuaternion_t& a, const vr::HmdQuaternion_t& b) {
+			vr::HmdQuaternion_t q;
+			q.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+			q.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+			q.y = a.w * b.y + a.y * b.w + a.z * b.x - a.x * b.z;
+			q.z = a.w * b.z + a.z * b.w + a.x * b.y - a.y * b.x;
+			return q;
+		}
+
+		/* Rotates v by the unit quaternion q: v + 2w (u x v) + 2 u x (u x v), with u the vector part of q. */
+		static void Rotate(const vr::HmdQuaternion_t& q, const double* v, double* out) {
+			const double tx = 2.0 * (q.y * v[2] - q.z * v[1]);
+			const double ty = 2.0 * (q.z * v[0] - q.x * v[2]);
+			const double tz = 2.0 * (q.x * v[1] - q.y * v[0]);
+			out[0] = v[0] + q.w * tx + (q.y * tz - q.z * ty);
+			out[1] = v[1] + q.w * ty + (q.z * tx - q.x * tz);
+			out[2] = v[2] + q.w * tz + (q.x * ty - q.y * tx);
+		}
+
+		/**
+		 * Claims the next entry of a ring and runs fill on its slot, under the slot's seqlock. Returns the entry, or
+		 * 0 without writing anything if the slot is still held by another writer, or a newer entry already took it.
+		 */
+		template<typename T, uint32_t Count, typename F>
+		static uint64_t Write(Ring<T, Count>& ring, const F& fill) {
+			const uint64_t entry = ring.index.fetch_add(1, std::memory_order_relaxed) + 1;
+			Slot<T>& slot = ring.slots[entry % Count];
+
+			uint64_t current = slot.sequence.load(std::memory_order_relaxed);
+			do {
+				if ((current & 1) || current > (entry << 1)) return 0;
+			} while (!slot.sequence.compare_exchange_weak(current, (entry << 1) | 1, std::memory_order_relaxed));
+			std::atomic_thread_fence(std::memory_order_release);
+
+			fill(slot.pose);
+
+			slot.sequence.store(entry << 1, std::memory_order_release);
+			return entry;
+		}
+
+		/**
+		 * Copies entry `entry` out of its slot, if the slot holds exactly that entry both before and after the copy.
+		 */
+		template<typename T, uint32_t Count>
+		static ReadResult TryRead(const Ring<T, Count>& ring, uint64_t entry, T& out) {
+			const Slot<T>& slot = ring.slots[entry % Count];
+			const uint64_t expected = entry << 1;
+
+			uint64_t before = slot.sequence.load(std::memory_order_acquire);
+			for (int retry = 0; before == (expected | 1) && retry < WRITE_IN_PROGRESS_RETRIES; retry++) {
+				before = slot.sequence.load(std::memory_order_acquire);
 			}
+			if (before < expected || before == (expected | 1)) return ReadNotWritten;
+			if (before != expected) return ReadOverwritten;
+
+			// The copy may race with a writer lapping us; the second sequence check tells us if it did.
+			out = slot.pose;
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			const uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+			return after == expected ? ReadOk : ReadOverwritten;
+		}
+
+		/**
+		 * Calls visit for every entry of the ring written since the cursor, oldest first, up to maxPoses of them.
+		 * Entries that were overwritten before they could be read in one piece are skipped. If an entry is still
+		 * being written, reading stops there and resumes from it on the next call; if it is still missing by then,
+		 * its writer dropped it or died, and it is skipped as well.
+		 */
+		template<typename T, uint32_t Count, typename F>
+		void ReadRing(const Ring<T, Count>& ring, Cursor& cursor, size_t maxPoses, F& visit) {
+			uint64_t cur_index = ring.index.load(std::memory_order_acquire);
+			if (cur_index < cursor.entry || cur_index - cursor.entry > Count / 2) {
+				const uint64_t resume = cur_index < Count / 2 ? cur_index : cur_index - Count / 2;
 
-			while (cursor < cur_index) {
-				cb(pData->poses[cursor % BUFFERED_SAMPLES]);
-				cursor++;
+				// A reader that fell behind loses the poses it skips. A cursor still at 0 has not read anything yet.
+				if (cursor.entry != 0 && cursor.entry < resume)
+					skippedPoses += resume - cursor.entry;
+
+				cursor.entry = resume;
 			}
 
-			std::atomic_thread_fence(std::memory_order_release);
+			T pose;
+			size_t delivered = 0;
+			while (cursor.entry < cur_index && delivered < maxPoses) {
+				const ReadResult result = TryRead(ring, cursor.entry + 1, pose);
+				if (result == ReadNotWritten && cursor.stalledEntry != cursor.entry + 1) {
+					cursor.stalledEntry = cursor.entry + 1;
+					break;
+				}
+
+				cursor.entry++;
+				if (result == ReadOk) {
+					visit(pose);
+					delivered++;
+				}
+				else skippedPoses++;
+			}
+		}
+
+	public:
+		operator bool() const {
+			return pData != nullptr;
+		}
+
+		bool operator!() const {
+			return pData == nullptr;
+		}
+
+		DriverPoseShmem() {
+#ifdef _WIN32
+			hNewPoseEvent = NULL;
+#endif
+			pData = nullptr;
+			skippedPoses = 0;
+			fullPosesEnabled = false;
+			fullPoseLease = 0;
+		}
+
+		~DriverPoseShmem() {
+			Close();
+		}
+
+		void Close() {
+			SetFullPosesEnabled(false);
+
+#ifdef _WIN32
+			if (hNewPoseEvent) CloseHandle(hNewPoseEvent);
+			hNewPoseEvent = NULL;
+#endif
+			segment.Close();
+			pData = nullptr;
+		}
+
+		bool Create(const char* segment_name) {
+			Close();
+
+			// New segments are zero-filled, which is a valid empty ring: index 0, and every slot at sequence 0.
+			if (!segment.Create(segment_name, sizeof(ShmemData))) return false;
+			pData = static_cast<ShmemData*>(segment.Data());
+
+#ifdef _WIN32
+			// Manual-reset, so that one SetEvent releases every waiting reader. Without it readers just poll.
+			hNewPoseEvent = CreateEventA(NULL, TRUE, FALSE, NewPoseEventName(segment_name).c_str());
+#endif
+
+			pData->compactPoseVersion = CompactPoseVersion;
+			return true;
+		}
+
+		static void Unlink(const char* segment_name) {
+			SharedSegment::Unlink(segment_name);
+		}
+
+		void Open(const char* segment_name) {
+			Close();
+
+			segment.Open(segment_name, sizeof(ShmemData), "pose data");
+			pData = static_cast<ShmemData*>(segment.Data());
+
+#ifdef _WIN32
+			// Not fatal: NotificationsAvailable reports whether we got it.
+			hNewPoseEvent = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, NewPoseEventName(segment_name).c_str());
+#endif
+
+			if (pData->compactPoseVersion != CompactPoseVersion) {
+				const uint32_t version = pData->compactPoseVersion;
+				Close();
+				throw std::runtime_error("Pose data shared memory segment has record version " + std::to_string(version)
+					+ ", expected " + std::to_string(CompactPoseVersion));
+			}
+		}
+
+		/**
+		 * Calls visit(CompactPose const&) for every pose written since the last call, oldest first. Poses that could
+		 * not be read in one piece are skipped (see SkippedPoses). The visitor is a template parameter so that it
+		 * can be inlined into the read loop.
+		 */
+		template<typename F>
+		void ReadNewPoses(F visit) {
+			if (!pData) throw std::runtime_error("Not open");
+
+			ReadRing(pData->poses, cursor, SIZE_MAX, visit);
+		}
+
+		/**
+		 * Batch form of ReadNewPoses: copies up to `capacity` new poses into `out`, oldest first, and returns how many
+		 * it copied. Poses beyond `capacity` are left for the next call. Slots are not handed out in place, as a slot
+		 * can only be known to be intact once it has been copied and its sequence counter checked again.
+		 */
+		size_t ReadNewPoses(CompactPose* out, size_t capacity) {
+			if (!pData) throw std::runtime_error("Not open");
+
+			size_t count = 0;
+			auto append = [out, &count](CompactPose const& pose) { out[count++] = pose; };
+			ReadRing(pData->poses, cursor, capacity, append);
+			return count;
 		}
 
-		bool GetPose(int index, vr::DriverPose_t& pose, LARGE_INTEGER *pSampleTime = NULL) {
-			ReadNewPoses([this](AugmentedPose const& pose) {
-				if (pose.pose.poseIsValid) {
-					this->lastPose[pose.deviceId] = pose;
+		/**
+		 * Asks the driver to also publish full AugmentedPose records, for ReadNewFullPoses. The driver only does so
+		 * for FULL_POSE_LEASE_MS after the last call that enabled them or read them, so a reader has to keep calling
+		 * one or the other, as it would to read the records anyway; a reader that crashes stops the extra writes
+		 * within that time.
+		 */
+		void SetFullPosesEnabled(bool enabled) {
+			if (!pData) return;
+
+			if (enabled) {
+				if (!fullPosesEnabled) {
+					fullCursor.entry = pData->fullPoses.index.load(std::memory_order_acquire);
+					fullPoseLease = 0;
 				}
-			});
+				RenewFullPoseLease();
+			}
+			else if (fullPosesEnabled) {
+				// Give the lease back, unless another reader has taken a longer one since.
+				int64_t lease = fullPoseLease;
+				pData->fullPoseLease.compare_exchange_strong(lease, 0, std::memory_order_relaxed);
+			}
+			fullPosesEnabled = enabled;
+		}
 
-			if (index >= 0 && index < vr::k_unMaxTrackedDeviceCount) {
-				pose = lastPose[index].pose;
-				if (pSampleTime) *pSampleTime = lastPose[index].sample_time;
-				return true;
+		/* Like ReadNewPoses, for the full records. Requires SetFullPosesEnabled(true), and renews its lease. */
+		template<typename F>
+		void ReadNewFullPoses(F visit) {
+			if (!pData) throw std::runtime_error("Not open");
+			if (!fullPosesEnabled) throw std::runtime_error("Full poses not enabled");
+
+			RenewFullPoseLease();
+			ReadRing(pData->fullPoses, fullCursor, SIZE_MAX, visit);
+		}
+
+		/* Whether WaitForNewPoses can block until the driver writes; if not, it returns immediately. */
+		bool NotificationsAvailable() const {
+#ifdef _WIN32
+			return pData != nullptr && hNewPoseEvent != NULL;
+#elif defined(__linux__)
+			return pData != nullptr;
+#else
+			return false;
+#endif
+		}
+
+		/* Entry number of the newest pose claimed by a writer, for WaitForNewPoses. */
+		uint64_t PoseEntry() const {
+			if (!pData) throw std::runtime_error("Not open");
+			return pData->poses.index.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Blocks until the driver has written a pose past entry `seenEntry` (see PoseEntry), or until timeoutMs has
+		 * passed, and returns the newest entry. Writers wake waiters at most once per millisecond, so a pose written
+		 * right after another one may only be noticed with the next write, or once the timeout expires. Does not
+		 * touch the read cursors, so it may be called from a different thread than the Read functions.
+		 */
+		uint64_t WaitForNewPoses(uint64_t seenEntry, uint32_t timeoutMs) const {
+			if (!pData) throw std::runtime_error("Not open");
+			if (!NotificationsAvailable()) return PoseEntry();
+
+			pData->notifyWaiters.fetch_add(1, std::memory_order_relaxed);
+#ifdef _WIN32
+			// Reset before looking at the ring, so that a write after the check still leaves the event set.
+			ResetEvent(hNewPoseEvent);
+#elif defined(__linux__)
+			const uint32_t sequence = pData->notifySequence.load(std::memory_order_relaxed);
+#endif
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			uint64_t entry = PoseEntry();
+			if (entry == seenEntry) {
+#ifdef _WIN32
+				WaitForSingleObject(hNewPoseEvent, timeoutMs);
+#elif defined(__linux__)
+				const timespec timeout = { (time_t)(timeoutMs / 1000), (long)(timeoutMs % 1000) * 1000000 };
+				Futex(FUTEX_WAIT, sequence, &timeout);
+#endif
+				entry = PoseEntry();
 			}
+
+			pData->notifyWaiters.fetch_sub(1, std::memory_order_relaxed);
+			return entry;
+		}
+
+		/* Makes ReadNewPoses start with the next pose written, rather than with the older poses still in the ring. */
+		void SkipToLatest() {
+			if (!pData) throw std::runtime_error("Not open");
+			cursor.entry = pData->poses.index.load(std::memory_order_acquire);
+			cursor.stalledEntry = 0;
+		}
+
+		/**
+		 * Number of poses the Read functions had to skip: because they were overwritten mid-read or never completed,
+		 * or because the reader fell so far behind that the writers lapped it.
+		 */
+		uint64_t SkippedPoses() const {
+			return skippedPoses;
+		}
+
+		/**
+		 * Fetches the newest pose of one device, independently of ReadNewPoses. Returns false if the device has not
+		 * published a pose yet, or if its newest pose has already been overwritten in the ring (that is, the device
+		 * has been silent while every other device filled the whole ring).
+		 */
+		bool GetLatestPose(int index, CompactPose& pose) const {
+			if (!pData) throw std::runtime_error("Not open");
+			if (index < 0 || (uint32_t)index >= vr::k_unMaxTrackedDeviceCount) return false;
+
+			const std::atomic<uint64_t>& latest = pData->latestEntry[index];
+
+			// A lost race with a writer means the device has a newer pose; try again with that one.
+			for (int attempt = 0; attempt < WRITE_IN_PROGRESS_RETRIES; attempt++) {
+				const uint64_t entry = latest.load(std::memory_order_acquire);
+				if (entry == 0) return false;
+
+				if (TryRead(pData->poses, entry, pose) == ReadOk) return true;
+				if (latest.load(std::memory_order_acquire) == entry) return false;
+			}
+			return false;
 		}
 
 		void SetPose(int index, const vr::DriverPose_t& pose) {
-			if (index >= vr::k_unMaxTrackedDeviceCount) return;
+			if (index < 0 || (uint32_t)index >= vr::k_unMaxTrackedDeviceCount) return;
 			if (pData == nullptr) return;
 
-			AugmentedPose augPose;
-			augPose.deviceId = index;
-			augPose.pose = pose;
-			QueryPerformanceCounter(&augPose.sample_time);
+			const int64_t sampleTime = Timestamp();
+
+			const uint64_t entry = Write(pData->poses, [&](CompactPose& record) {
+				const vr::HmdQuaternion_t rotation = Multiply(pose.qWorldFromDriverRotation, pose.qRotation);
+				Rotate(pose.qWorldFromDriverRotation, pose.vecPosition, record.position);
+				for (int i = 0; i < 3; i++) record.position[i] += pose.vecWorldFromDriverTranslation[i];
+
+				record.rotation[0] = (float)rotation.w;
+				record.rotation[1] = (float)rotation.x;
+				record.rotation[2] = (float)rotation.y;
+				record.rotation[3] = (float)rotation.z;
+
+				record.sampleTime = sampleTime;
+				record.deviceId = (uint16_t)index;
+				record.result = (uint8_t)pose.result;
+				record.flags = (uint8_t)((pose.poseIsValid ? CompactPose::PoseIsValid : 0)
+					| (pose.deviceIsConnected ? CompactPose::DeviceIsConnected : 0));
+			});
+
+			// Writers for the same device may finish out of order, so only ever move the latest entry forward.
+			if (entry != 0) {
+				std::atomic<uint64_t>& latest = pData->latestEntry[index];
+				uint64_t previous = latest.load(std::memory_order_relaxed);
+				while (previous < entry && !latest.compare_exchange_weak(previous, entry, std::memory_order_release, std::memory_order_relaxed)) { }
+			}
+
+			if (sampleTime < pData->fullPoseLease.load(std::memory_order_relaxed)) {
+				Write(pData->fullPoses, [&](AugmentedPose& record) {
+					record.sample_time = sampleTime;
+					record.deviceId = index;
+					record.pose = pose;
+				});
+			}
+
+			if (entry != 0) NotifyNewPoses(sampleTime);
+		}
+	};
+	/**
+	 * The transform every device should have, published by the application for the driver's pose hook.
+	 *
+	 * The driver creates the segment and the application is its only writer. Publish rewrites the whole table
+	 * under a seqlock on the generation counter, which is odd while a write is in progress. The driver checks
+	 * the counter with a single load on every pose, and only copies the table (and re-checks the counter, to
+	 * reject a copy that raced with a write) once it has moved.
+	 */
+	class DeviceTransformShmem {
+	private:
+		static const uint32_t TableVersion = 1;
+
+		struct ControlData {
+			uint32_t tableVersion;
+			alignas(64) std::atomic<uint64_t> generation;
+			SetDeviceTransforms table;
+		};
+
+		SharedSegment segment;
+		ControlData* pData = nullptr;
+
+		static void CopyTable(const SetDeviceTransforms& from, SetDeviceTransforms& to) {
+			to.alignmentSpeedParams = from.alignmentSpeedParams;
+			to.count = std::min<uint32_t>(from.count, vr::k_unMaxTrackedDeviceCount);
+			for (uint32_t i = 0; i < to.count; i++) {
+				to.transforms[i] = from.transforms[i];
+			}
+		}
+
+	public:
+		operator bool() const {
+			return pData != nullptr;
+		}
+
+		bool operator!() const {
+			return pData == nullptr;
+		}
+
+		void Close() {
+			segment.Close();
+			pData = nullptr;
+		}
+
+		/* A new segment starts at generation 0 with an empty table, which readers never apply. */
+		bool Create(const char* segment_name) {
+			Close();
+
+			if (!segment.Create(segment_name, sizeof(ControlData))) return false;
+			pData = static_cast<ControlData*>(segment.Data());
+			pData->tableVersion = TableVersion;
+			return true;
+		}
+
+		static void Unlink(const char* segment_name) {
+			SharedSegment::Unlink(segment_name);
+		}
+
+		void Open(const char* segment_name) {
+			Close();
+
+			segment.Open(segment_name, sizeof(ControlData), "device transform");
+			pData = static_cast<ControlData*>(segment.Data());
+
+			if (pData->tableVersion != TableVersion) {
+				const uint32_t version = pData->tableVersion;
+				Close();
+				throw std::runtime_error("Device transform shared memory segment has table version " + std::to_string(version)
+					+ ", expected " + std::to_string(TableVersion));
+			}
+		}
+
+		/* Replaces the published table. Must only be called from one thread of one process. */
+		void Publish(const SetDeviceTransforms& table) {
+			if (!pData) throw std::runtime_error("Not open");
 
-			uint64_t cur_index = pData->index.load(std::memory_order_relaxed) + 1;
-			pData->poses[cur_index % BUFFERED_SAMPLES] = augPose;
-			pData->index.store(cur_index, std::memory_order_release);
+			const uint64_t generation = pData->generation.load(std::memory_order_relaxed);
+			pData->generation.store(generation + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			CopyTable(table, pData->table);
+
+			pData->generation.store(generation + 2, std::memory_order_release);
+		}
+
+		/* Generation of the published table; it changes whenever the table may have. 0 until the first Publish. */
+		uint64_t Generation() const {
+			return pData ? pData->generation.load(std::memory_order_acquire) : 0;
+		}
+
+		/**
+		 * Copies the published table and stores its generation. Returns false, leaving both unspecified, if
+		 * nothing was published yet or the writer was in the middle of a Publish; the caller tries again later.
+		 */
+		bool Read(SetDeviceTransforms& table, uint64_t& generation) const {
+			if (!pData) return false;
+
+			const uint64_t before = pData->generation.load(std::memory_order_acquire);
+			if (before == 0 || (before & 1)) return false;
+
+			CopyTable(pData->table, table);
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (pData->generation.load(std::memory_order_relaxed) != before) return false;
+			generation = before;
+			return true;
+		}
+	};
+	/**
+	 * Latency histogram in the style of HdrHistogram, over nanoseconds. Values below 2 * SubBuckets get a bucket
+	 * each; above that, every power of two is split into SubBuckets equal buckets, so a value read back is within
+	 * 1 / SubBuckets of the one recorded. Values of 2^MaxMagnitude ns (about a minute) and up share the last bucket.
+	 */
+	struct LatencyHistogram {
+		static const uint32_t SubBucketBits = 4;
+		static const uint32_t SubBuckets = 1 << SubBucketBits;
+		static const uint32_t MaxMagnitude = 36;
+		static const uint32_t BucketCount = (MaxMagnitude - SubBucketBits + 1) * SubBuckets;
+
+		static uint32_t BucketOf(uint64_t value) {
+			if (value >= (uint64_t)1 << MaxMagnitude) return BucketCount - 1;
+			if (value < 2 * SubBuckets) return (uint32_t)value;
+
+			const uint32_t shift = HighestBit(value) - SubBucketBits;
+			return shift * SubBuckets + (uint32_t)(value >> shift);
+		}
+
+		/* Largest value that lands in the bucket. */
+		static uint64_t BucketValue(uint32_t bucket) {
+			if (bucket < 2 * SubBuckets) return bucket;
+
+			const uint32_t shift = bucket / SubBuckets - 1;
+			const uint64_t subBucket = bucket % SubBuckets + SubBuckets;
+			return ((subBucket + 1) << shift) - 1;
+		}
+
+		/* Snapshot of a histogram's counts, taken by DriverStatsShmem::Read. */
+		struct Counts {
+			uint64_t buckets[BucketCount];
+
+			uint64_t Total() const {
+				uint64_t total = 0;
+				for (uint32_t i = 0; i < BucketCount; i++) total += buckets[i];
+				return total;
+			}
+
+			/* Smallest recorded value that at least `fraction` of the samples do not exceed, or 0 if there are none. */
+			uint64_t Percentile(double fraction) const {
+				const uint64_t total = Total();
+				if (total == 0) return 0;
+
+				const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(fraction * (double)total));
+				uint64_t seen = 0;
+				for (uint32_t i = 0; i < BucketCount; i++) {
+					seen += buckets[i];
+					if (seen >= rank) return BucketValue(i);
+				}
+				return BucketValue(BucketCount - 1);
+			}
+		};
+
+		std::atomic<uint64_t> buckets[BucketCount];
+
+		void Record(uint64_t value) {
+			buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void Read(Counts& counts) const {
+			for (uint32_t i = 0; i < BucketCount; i++) {
+				counts.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		static uint32_t HighestBit(uint64_t value) {
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanReverse64(&index, value);
+			return (uint32_t)index;
+#else
+			return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+		}
+	};
+
+	/**
+	 * What the pose hook costs SteamVR, per device: how often each hooked TrackedDevicePoseUpdated is called, and
+	 * latency histograms of the whole detour (including SteamVR's own handling of the pose, in the original
+	 * function) and of HandleDevicePoseUpdated alone.
+	 *
+	 * The driver creates the segment and records into it from the pose hook with relaxed atomic increments, so
+	 * recording never locks or waits. Readers copy the counters while the driver keeps recording; a snapshot can
+	 * be a few samples out of step between buckets, which does not matter for percentiles. Times are taken with
+	 * Timestamp, which reads the TSC on Windows: QueryPerformanceCounter only resolves 100 ns, too coarse for a
+	 * hook that often takes less than that. Create measures the TSC rate against QueryPerformanceCounter once,
+	 * and Record scales durations to nanoseconds with it.
+	 */
+	class DriverStatsShmem {
+	public:
+		enum HookInterface {
+			ServerDriverHost005,
+			ServerDriverHost006,
+			HookInterfaceCount
+		};
+
+		/* Snapshot of one device's statistics, taken by Read. */
+		struct DeviceStats {
+			uint64_t calls[HookInterfaceCount];
+			LatencyHistogram::Counts hook, handle;
+
+			uint64_t Calls() const {
+				uint64_t total = 0;
+				for (int i = 0; i < HookInterfaceCount; i++) total += calls[i];
+				return total;
+			}
+		};
+
+	private:
+		static const uint32_t StatsVersion = 2;
+
+		struct alignas(64) DeviceData {
+			std::atomic<uint64_t> calls[HookInterfaceCount];
+			LatencyHistogram hook, handle;
+		};
+
+		struct StatsData {
+			uint32_t statsVersion;
+			DeviceData devices[vr::k_unMaxTrackedDeviceCount];
+		};
+
+		SharedSegment segment;
+		StatsData* pData = nullptr;
+		double nanosecondsPerTick = 1.0; // of Timestamp
+
+		uint64_t Nanoseconds(int64_t ticks) const {
+			return ticks > 0 ? (uint64_t)((double)ticks * nanosecondsPerTick) : 0;
+		}
+
+		/* Length of a Timestamp tick, measured against QueryPerformanceCounter where Timestamp reads the TSC. */
+		static double MeasureTickLength() {
+#if defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+			LARGE_INTEGER freq, qpcStart, qpcEnd;
+			QueryPerformanceFrequency(&freq);
+			QueryPerformanceCounter(&qpcStart);
+			const int64_t start = Timestamp();
+			Sleep(20);
+			QueryPerformanceCounter(&qpcEnd);
+			const int64_t end = Timestamp();
+
+			const double nanoseconds = (double)(qpcEnd.QuadPart - qpcStart.QuadPart) * 1e9 / (double)freq.QuadPart;
+			return end > start ? nanoseconds / (double)(end - start) : 1.0;
+#elif defined(_WIN32)
+			LARGE_INTEGER freq;
+			QueryPerformanceFrequency(&freq);
+			return 1e9 / (double)freq.QuadPart;
+#else
+			return 1.0;
+#endif
+		}
+
+	public:
+		operator bool() const {
+			return pData != nullptr;
+		}
+
+		bool operator!() const {
+			return pData == nullptr;
+		}
+
+		/**
+		 * Ticks of the finest monotonic clock at hand, for Record: the TSC on x86 Windows (which every CPU SteamVR
+		 * supports keeps invariant), QueryPerformanceCounter on other Windows, and nanoseconds elsewhere.
+		 */
+		static int64_t Timestamp() {
+#if defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+			return (int64_t)__rdtsc();
+#elif defined(_WIN32)
+			LARGE_INTEGER ts;
+			QueryPerformanceCounter(&ts);
+			return ts.QuadPart;
+#else
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+		}
+
+		void Close() {
+			segment.Close();
+			pData = nullptr;
+		}
+
+		/* A new segment starts with every counter at zero. */
+		bool Create(const char* segment_name) {
+			Close();
+
+			if (!segment.Create(segment_name, sizeof(StatsData))) return false;
+			pData = static_cast<StatsData*>(segment.Data());
+			pData->statsVersion = StatsVersion;
+			nanosecondsPerTick = MeasureTickLength();
+			return true;
+		}
+
+		static void Unlink(const char* segment_name) {
+			SharedSegment::Unlink(segment_name);
+		}
+
+		void Open(const char* segment_name) {
+			Close();
+
+			segment.Open(segment_name, sizeof(StatsData), "driver statistics");
+			pData = static_cast<StatsData*>(segment.Data());
+
+			if (pData->statsVersion != StatsVersion) {
+				const uint32_t version = pData->statsVersion;
+				Close();
+				throw std::runtime_error("Driver statistics shared memory segment has version " + std::to_string(version)
+					+ ", expected " + std::to_string(StatsVersion));
+			}
+		}
+
+		/**
+		 * Records one call of the pose hook, with times from Timestamp: `entered` is when the detour was entered,
+		 * `handled` when HandleDevicePoseUpdated returned, and `exited` when the original function did.
+		 */
+		void Record(uint32_t index, HookInterface hookInterface, int64_t entered, int64_t handled, int64_t exited) {
+			if (!pData || index >= vr::k_unMaxTrackedDeviceCount) return;
+
+			DeviceData& device = pData->devices[index];
+			device.calls[hookInterface].fetch_add(1, std::memory_order_relaxed);
+			device.hook.Record(Nanoseconds(exited - entered));
+			device.handle.Record(Nanoseconds(handled - entered));
+		}
+
+		/* Number of hook calls recorded for the device; cheaper than Read when only the rate is wanted. */
+		uint64_t Calls(uint32_t index) const {
+			if (!pData) throw std::runtime_error("Not open");
+			if (index >= vr::k_unMaxTrackedDeviceCount) return 0;
+
+			uint64_t total = 0;
+			for (int i = 0; i < HookInterfaceCount; i++) {
+				total += pData->devices[index].calls[i].load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+		/* Copies the statistics of one device, recorded since the driver started. */
+		void Read(uint32_t index, DeviceStats& stats) const {
+			if (!pData) throw std::runtime_error("Not open");
+			if (index >= vr::k_unMaxTrackedDeviceCount) throw std::out_of_range("Device index out of range");
+
+			const DeviceData& device = pData->devices[index];
+			for (int i = 0; i < HookInterfaceCount; i++) {
+				stats.calls[i] = device.calls[i].load(std::memory_order_relaxed);
+			}
+			device.hook.Read(stats.hook);
+			device.handle.Read(stats.handle);
 		}
 	};
 }
\ No newline at end of file